@@ -0,0 +1,437 @@
+/* cache.c: Buffer cache of file system sectors.
+ *
+ * Every access to the data on the file system disk goes through a
+ * cache of CACHE_SIZE sectors, indexed by a hash table on the sector
+ * number and replaced with the clock algorithm.  A write only dirties
+ * the cached sector.  A flusher thread writes dirty sectors back every
+ * FLUSH_INTERVAL, runs of consecutive sectors in one command, and
+ * filesys_done() writes back whatever is left.  A second thread reads
+ * ahead the sector that follows a sequential read.
+ *
+ * An entry is pinned while a thread copies data in or out of it, and
+ * is not replaced then.  An entry whose contents are not there yet is
+ * marked loading, and other users wait until they are. */
+
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/filesys.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Number of sectors in the cache. */
+#define CACHE_SIZE 64
+
+/* Most sectors read or written back with one command. */
+#define CACHE_RUN 16
+
+/* Time between two write-backs of the dirty sectors. */
+#define FLUSH_INTERVAL (5 * TIMER_FREQ)
+
+/* Most sectors waiting to be read ahead. */
+#define RA_QUEUE_SIZE 16
+
+/* A cached sector. */
+struct cache_entry {
+	disk_sector_t sector;           /* Sector held, if VALID. */
+	bool valid;                     /* Holds a sector. */
+	bool dirty;                     /* Changed since read or written. */
+	bool accessed;                  /* Used since the clock passed. */
+	bool loading;                   /* DATA is not filled in yet. */
+	int pins;                       /* Threads using the entry. */
+	struct hash_elem elem;          /* In cache_index. */
+	uint8_t data[DISK_SECTOR_SIZE]; /* Contents of the sector. */
+};
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct hash cache_index;     /* Valid entries, by sector. */
+static size_t clock_hand;           /* Next entry the clock looks at. */
+static struct lock cache_lock;      /* Protects everything above, and the
+                                       read-ahead queue, but not the
+                                       data of pinned entries. */
+static struct condition cache_cond; /* Signaled, with cache_lock, when an
+                                       entry is unpinned or loaded. */
+
+/* Sectors to read ahead, in a ring. */
+static disk_sector_t ra_queue[RA_QUEUE_SIZE];
+static size_t ra_head, ra_len;
+static struct semaphore ra_sema;    /* Up'd for every queued sector. */
+
+/* Statistics. */
+static size_t hit_cnt;              /* Accesses to cached sectors. */
+static size_t miss_cnt;             /* Sectors read on an access. */
+static size_t ra_read_cnt;          /* Sectors read ahead. */
+static size_t evict_cnt;            /* Sectors replaced. */
+static size_t write_back_cnt;       /* Sectors written back. */
+static size_t write_back_cmd_cnt;   /* Commands that wrote them. */
+
+static hash_hash_func cache_hash;
+static hash_less_func cache_less;
+static void cache_flusher (void *aux);
+static void cache_readahead_worker (void *aux);
+
+/* Initializes the buffer cache and starts its threads. */
+void
+cache_init (void) {
+	hash_init (&cache_index, cache_hash, cache_less, NULL);
+	lock_init (&cache_lock);
+	cond_init (&cache_cond);
+	sema_init (&ra_sema, 0);
+	thread_create ("flusher", PRI_DEFAULT, cache_flusher, NULL);
+	thread_create ("readahead-fs", PRI_DEFAULT, cache_readahead_worker, NULL);
+}
+
+/* Returns a hash value for entry E. */
+static uint64_t
+cache_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct cache_entry, elem)->sector);
+}
+
+/* Returns true if entry A holds a sector before that of entry B. */
+static bool
+cache_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct cache_entry, elem)->sector
+		< hash_entry (b, struct cache_entry, elem)->sector;
+}
+
+/* Returns the entry holding SECTOR, or a null pointer.
+ * Caller must hold cache_lock. */
+static struct cache_entry *
+cache_lookup (disk_sector_t sector) {
+	struct cache_entry key;
+	struct hash_elem *e;
+
+	key.sector = sector;
+	e = hash_find (&cache_index, &key.elem);
+	return e != NULL ? hash_entry (e, struct cache_entry, elem) : NULL;
+}
+
+/* Writes dirty entry E back to disk, together with the dirty entries
+ * of the sectors right after it, in one command.  Drops cache_lock
+ * while writing. */
+static void
+cache_write_back (struct cache_entry *e) {
+	struct cache_entry *run[CACHE_RUN];
+	const void *buffers[CACHE_RUN];
+	disk_sector_t sector = e->sector;
+	size_t cnt = 0, i;
+
+	ASSERT (e->dirty && e->pins == 0 && !e->loading);
+
+	do {
+		e->dirty = false;
+		e->pins++;
+		run[cnt] = e;
+		buffers[cnt] = e->data;
+		cnt++;
+		e = cache_lookup (sector + cnt);
+	} while (cnt < CACHE_RUN && e != NULL
+			&& e->dirty && e->pins == 0 && !e->loading);
+
+	lock_release (&cache_lock);
+	disk_write_sectors (filesys_disk, sector, buffers, cnt);
+	lock_acquire (&cache_lock);
+
+	for (i = 0; i < cnt; i++)
+		run[i]->pins--;
+	write_back_cnt += cnt;
+	write_back_cmd_cnt++;
+	cond_broadcast (&cache_cond, &cache_lock);
+}
+
+/* Chooses an entry to replace with the clock algorithm: an unused
+ * entry, or one that was not accessed since the clock last passed.
+ * Returns a null pointer if every entry is in use. */
+static struct cache_entry *
+cache_victim (void) {
+	size_t i;
+
+	for (i = 0; i < 2 * CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[clock_hand];
+
+		clock_hand = (clock_hand + 1) % CACHE_SIZE;
+		if (e->pins > 0 || e->loading)
+			continue;
+		if (!e->valid)
+			return e;
+		if (e->accessed)
+			e->accessed = false;
+		else
+			return e;
+	}
+	return NULL;
+}
+
+/* Takes an entry for SECTOR, which is not cached, and returns it
+ * pinned and loading.  Returns a null pointer if no clean entry is
+ * free.  If WAIT is true, it first drops cache_lock to write back a
+ * dirty victim or to wait for an entry, and the caller must then look
+ * SECTOR up again.
+ * Caller must hold cache_lock. */
+static struct cache_entry *
+cache_alloc (disk_sector_t sector, bool wait) {
+	struct cache_entry *e = cache_victim ();
+
+	if (e == NULL) {
+		if (wait)
+			cond_wait (&cache_cond, &cache_lock);
+		return NULL;
+	}
+	if (e->dirty) {
+		if (wait)
+			cache_write_back (e);
+		return NULL;
+	}
+	if (e->valid) {
+		hash_delete (&cache_index, &e->elem);
+		evict_cnt++;
+	}
+
+	e->sector = sector;
+	e->valid = true;
+	e->dirty = false;
+	e->accessed = true;
+	e->loading = true;
+	e->pins = 1;
+	hash_insert (&cache_index, &e->elem);
+	return e;
+}
+
+/* Reads the CNT loading entries RUN, which hold consecutive sectors,
+ * from disk in one command.  Drops cache_lock while reading. */
+static void
+cache_load (struct cache_entry *run[], size_t cnt) {
+	void *buffers[CACHE_RUN];
+	size_t i;
+
+	ASSERT (cnt > 0 && cnt <= CACHE_RUN);
+
+	for (i = 0; i < cnt; i++)
+		buffers[i] = run[i]->data;
+	lock_release (&cache_lock);
+	disk_read_sectors (filesys_disk, run[0]->sector, buffers, cnt);
+	lock_acquire (&cache_lock);
+
+	for (i = 0; i < cnt; i++)
+		run[i]->loading = false;
+	cond_broadcast (&cache_cond, &cache_lock);
+}
+
+/* Returns the entry of SECTOR, pinned.  If SECTOR is not cached, it is
+ * read from disk if READ is true.  Otherwise the entry is returned
+ * still loading, for the caller to overwrite entirely. */
+static struct cache_entry *
+cache_get (disk_sector_t sector, bool read) {
+	struct cache_entry *e;
+
+	lock_acquire (&cache_lock);
+	for (;;) {
+		e = cache_lookup (sector);
+		if (e != NULL) {
+			if (e->loading) {
+				cond_wait (&cache_cond, &cache_lock);
+				continue;
+			}
+			e->pins++;
+			e->accessed = true;
+			hit_cnt++;
+			break;
+		}
+		e = cache_alloc (sector, true);
+		if (e != NULL) {
+			if (read) {
+				miss_cnt++;
+				cache_load (&e, 1);
+			}
+			break;
+		}
+	}
+	lock_release (&cache_lock);
+	return e;
+}
+
+/* Unpins entry E, marking it dirty if DIRTY is true. */
+static void
+cache_put (struct cache_entry *e, bool dirty) {
+	lock_acquire (&cache_lock);
+	if (dirty)
+		e->dirty = true;
+	e->loading = false;
+	e->pins--;
+	cond_broadcast (&cache_cond, &cache_lock);
+	lock_release (&cache_lock);
+}
+
+/* Reads SIZE bytes at offset OFS of SECTOR into BUFFER. */
+void
+cache_read (disk_sector_t sector, void *buffer, int ofs, int size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, true);
+	memcpy (buffer, e->data + ofs, size);
+	cache_put (e, false);
+}
+
+/* Writes SIZE bytes from BUFFER, or zeros if BUFFER is a null pointer,
+ * at offset OFS of SECTOR.  The sector is read first unless the whole
+ * of it is written. */
+void
+cache_write (disk_sector_t sector, const void *buffer, int ofs, int size) {
+	struct cache_entry *e;
+
+	ASSERT (ofs >= 0 && size >= 0 && ofs + size <= DISK_SECTOR_SIZE);
+
+	e = cache_get (sector, ofs > 0 || size < DISK_SECTOR_SIZE);
+	if (buffer != NULL)
+		memcpy (e->data + ofs, buffer, size);
+	else
+		memset (e->data + ofs, 0, size);
+	cache_put (e, true);
+}
+
+/* Reads the CNT whole sectors from SECTOR on into BUFFER.  The sectors
+ * that are not cached are read in runs, each with one command. */
+void
+cache_read_run (disk_sector_t sector, void *buffer_, size_t cnt) {
+	uint8_t *buffer = buffer_;
+
+	while (cnt > 0) {
+		struct cache_entry *run[CACHE_RUN];
+		size_t n = 0, i;
+
+		/* Take entries for the sectors from here on that are not cached.
+		 * Waiting for an entry while holding others could deadlock with
+		 * another reader doing the same, so stop at the first that is
+		 * not free. */
+		lock_acquire (&cache_lock);
+		while (n < cnt && n < CACHE_RUN && cache_lookup (sector + n) == NULL) {
+			struct cache_entry *e = cache_alloc (sector + n, false);
+
+			if (e == NULL)
+				break;
+			run[n++] = e;
+		}
+		if (n > 0) {
+			miss_cnt += n;
+			cache_load (run, n);
+		}
+		lock_release (&cache_lock);
+
+		if (n > 0) {
+			for (i = 0; i < n; i++) {
+				memcpy (buffer + i * DISK_SECTOR_SIZE, run[i]->data,
+						DISK_SECTOR_SIZE);
+				cache_put (run[i], false);
+			}
+		} else {
+			cache_read (sector, buffer, 0, DISK_SECTOR_SIZE);
+			n = 1;
+		}
+		sector += n;
+		buffer += n * DISK_SECTOR_SIZE;
+		cnt -= n;
+	}
+}
+
+/* Writes the CNT whole sectors from SECTOR on from BUFFER, or zeros
+ * them if BUFFER is a null pointer. */
+void
+cache_write_run (disk_sector_t sector, const void *buffer_, size_t cnt) {
+	const uint8_t *buffer = buffer_;
+	size_t i;
+
+	for (i = 0; i < cnt; i++)
+		cache_write (sector + i,
+				buffer != NULL ? buffer + i * DISK_SECTOR_SIZE : NULL,
+				0, DISK_SECTOR_SIZE);
+}
+
+/* Queues SECTOR to be read into the cache in the background, unless
+ * it is cached already or the queue is full. */
+void
+cache_readahead (disk_sector_t sector) {
+	lock_acquire (&cache_lock);
+	if (cache_lookup (sector) == NULL && ra_len < RA_QUEUE_SIZE) {
+		ra_queue[(ra_head + ra_len) % RA_QUEUE_SIZE] = sector;
+		ra_len++;
+		sema_up (&ra_sema);
+	}
+	lock_release (&cache_lock);
+}
+
+/* Read-ahead thread.  Reads the queued sectors that are still not
+ * cached by the time their turn comes. */
+static void
+cache_readahead_worker (void *aux UNUSED) {
+	for (;;) {
+		disk_sector_t sector;
+		struct cache_entry *e;
+
+		sema_down (&ra_sema);
+		lock_acquire (&cache_lock);
+		sector = ra_queue[ra_head];
+		ra_head = (ra_head + 1) % RA_QUEUE_SIZE;
+		ra_len--;
+
+		while (cache_lookup (sector) == NULL) {
+			e = cache_alloc (sector, true);
+			if (e != NULL) {
+				cache_load (&e, 1);
+				e->accessed = false;
+				e->pins--;
+				cond_broadcast (&cache_cond, &cache_lock);
+				ra_read_cnt++;
+				break;
+			}
+		}
+		lock_release (&cache_lock);
+	}
+}
+
+/* Writes every dirty sector back to disk. */
+void
+cache_flush (void) {
+	size_t i;
+
+	lock_acquire (&cache_lock);
+	for (i = 0; i < CACHE_SIZE; i++) {
+		struct cache_entry *e = &cache[i];
+
+		while (e->valid && e->dirty) {
+			if (e->pins > 0 || e->loading)
+				cond_wait (&cache_cond, &cache_lock);
+			else
+				cache_write_back (e);
+		}
+	}
+	lock_release (&cache_lock);
+}
+
+/* Write-behind thread.  Writes the dirty sectors back every
+ * FLUSH_INTERVAL. */
+static void
+cache_flusher (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (FLUSH_INTERVAL);
+		cache_flush ();
+	}
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void) {
+	size_t accesses = hit_cnt + miss_cnt;
+
+	printf ("Cache: %zu hits, %zu misses, %zu%% hit rate, "
+			"%zu sectors read ahead, %zu replaced\n",
+			hit_cnt, miss_cnt, accesses > 0 ? hit_cnt * 100 / accesses : 0,
+			ra_read_cnt, evict_cnt);
+	printf ("Cache: %zu sectors written back in %zu commands\n",
+			write_back_cnt, write_back_cmd_cnt);
+}
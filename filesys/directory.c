@@ -1,7 +1,9 @@
 #include "filesys/directory.h"
+#include <hash.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
+#include <round.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
@@ -19,10 +21,93 @@ struct dir_entry {
 	bool in_use;                        /* In use or free? */
 };
 
+/* A directory starts out linear: an array of entries, searched one
+ * by one.  Once it is full and holds DIR_HASH_MIN entries, it turns
+ * into a hashed directory, made of sector-sized blocks.  Block 0 is a
+ * struct dir_index.  Blocks 1 to BUCKET_CNT are the buckets of a hash
+ * table on the names, each chained to overflow blocks further on.  A
+ * lookup thus reads the index and one bucket, and overflow blocks only
+ * if the bucket is full.  The table doubles when it holds more entries
+ * than its buckets have room for, so that chains stay short.
+ *
+ * Adding or removing an entry leaves the others where they are.  The
+ * conversion and each doubling rewrite the whole directory, though,
+ * and move every entry, so the position of an open directory only
+ * means something until then: a dir_readdir() pass across a rehash may
+ * skip or repeat names. */
+
+/* Identifies a hashed directory.  A linear directory cannot start
+ * with it, because it is no valid sector number. */
+#define DIR_INDEX_MAGIC 0x48444952
+
+/* Entries of a full linear directory that turn it into a hashed
+ * one. */
+#define DIR_HASH_MIN 32
+
+/* Entries in a block of a hashed directory. */
+#define BLOCK_ENTRIES 25
+
+/* Block 0 of a hashed directory.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct dir_index {
+	uint32_t magic;                     /* DIR_INDEX_MAGIC. */
+	uint32_t bucket_cnt;                /* Buckets, a power of 2. */
+	uint32_t block_cnt;                 /* Blocks in use, this one too. */
+	uint32_t entry_cnt;                 /* Entries in use. */
+	uint8_t unused[DISK_SECTOR_SIZE - 16];  /* Not used. */
+};
+
+/* A bucket of a hashed directory, or an overflow block.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct dir_block {
+	struct dir_entry entries[BLOCK_ENTRIES];    /* Entries. */
+	uint32_t next;                      /* Overflow block, 0 if none. */
+	uint32_t unused[2];                 /* Not used. */
+};
+
+/* Reads block IDX of DIR into BLOCK.  Returns false on a short read. */
+static bool
+read_block (const struct dir *dir, uint32_t idx, void *block) {
+	return inode_read_at (dir->inode, block, DISK_SECTOR_SIZE,
+			idx * DISK_SECTOR_SIZE) == DISK_SECTOR_SIZE;
+}
+
+/* Writes BLOCK to block IDX of DIR.  Returns false on a short write. */
+static bool
+write_block (struct dir *dir, uint32_t idx, const void *block) {
+	return inode_write_at (dir->inode, block, DISK_SECTOR_SIZE,
+			idx * DISK_SECTOR_SIZE) == DISK_SECTOR_SIZE;
+}
+
+/* Reads the index of DIR into INDEX and returns true if DIR is hashed,
+ * otherwise returns false. */
+static bool
+read_index (const struct dir *dir, struct dir_index *index) {
+	return read_block (dir, 0, index) && index->magic == DIR_INDEX_MAGIC;
+}
+
+/* Returns the block of the bucket for NAME in a directory with
+ * INDEX. */
+static uint32_t
+bucket_block (const struct dir_index *index, const char *name) {
+	return 1 + (hash_string (name) & (index->bucket_cnt - 1));
+}
+
+/* Returns the byte offset of entry I of block BLK. */
+static off_t
+entry_ofs (uint32_t blk, size_t i) {
+	return blk * DISK_SECTOR_SIZE + i * sizeof (struct dir_entry);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
  * given SECTOR.  Returns true if successful, false on failure. */
 bool
 dir_create (disk_sector_t sector, size_t entry_cnt) {
+	/* If these assertions fail, the blocks of a hashed directory are
+	 * not exactly one sector in size, and you should fix that. */
+	ASSERT (sizeof (struct dir_index) == DISK_SECTOR_SIZE);
+	ASSERT (sizeof (struct dir_block) == DISK_SECTOR_SIZE);
+
 	return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
 }
 
@@ -75,16 +160,39 @@ dir_get_inode (struct dir *dir) {
  * If successful, returns true, sets *EP to the directory entry
  * if EP is non-null, and sets *OFSP to the byte offset of the
  * directory entry if OFSP is non-null.
- * otherwise, returns false and ignores EP and OFSP. */
+ * otherwise, returns false and ignores EP and OFSP.
+ * In a hashed directory, only the bucket of NAME is searched. */
 static bool
 lookup (const struct dir *dir, const char *name,
 		struct dir_entry *ep, off_t *ofsp) {
+	struct dir_index index;
 	struct dir_entry e;
 	size_t ofs;
 
 	ASSERT (dir != NULL);
 	ASSERT (name != NULL);
 
+	if (read_index (dir, &index)) {
+		struct dir_block block;
+		uint32_t blk;
+		size_t i;
+
+		for (blk = bucket_block (&index, name); blk != 0; blk = block.next) {
+			if (!read_block (dir, blk, &block))
+				return false;
+			for (i = 0; i < BLOCK_ENTRIES; i++)
+				if (block.entries[i].in_use
+						&& !strcmp (name, block.entries[i].name)) {
+					if (ep != NULL)
+						*ep = block.entries[i];
+					if (ofsp != NULL)
+						*ofsp = entry_ofs (blk, i);
+					return true;
+				}
+		}
+		return false;
+	}
+
 	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
 			ofs += sizeof e)
 		if (e.in_use && !strcmp (name, e.name)) {
@@ -97,6 +205,214 @@ lookup (const struct dir *dir, const char *name,
 	return false;
 }
 
+/* Returns the entries in use in DIR, in a new array whose length is
+ * stored in *CNT, or a null pointer if memory or a read fails.  The
+ * caller must free the array. */
+static struct dir_entry *
+read_entries (const struct dir *dir, size_t *cnt) {
+	struct dir_index index;
+	struct dir_entry *entries, e;
+	size_t max;
+	off_t ofs;
+
+	if (read_index (dir, &index)) {
+		struct dir_block block;
+		uint32_t blk;
+		size_t i;
+
+		entries = malloc (index.entry_cnt * sizeof *entries + 1);
+		if (entries == NULL)
+			return NULL;
+		*cnt = 0;
+		for (blk = 1; blk < index.block_cnt; blk++) {
+			if (!read_block (dir, blk, &block)) {
+				free (entries);
+				return NULL;
+			}
+			for (i = 0; i < BLOCK_ENTRIES; i++)
+				if (block.entries[i].in_use) {
+					ASSERT (*cnt < index.entry_cnt);
+					entries[(*cnt)++] = block.entries[i];
+				}
+		}
+		return entries;
+	}
+
+	max = inode_length (dir->inode) / sizeof e;
+	entries = malloc (max * sizeof *entries + 1);
+	if (entries == NULL)
+		return NULL;
+	*cnt = 0;
+	for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+			ofs += sizeof e)
+		if (e.in_use && *cnt < max)
+			entries[(*cnt)++] = e;
+	return entries;
+}
+
+/* Rewrites DIR as a hashed directory with BUCKET_CNT buckets, a power
+ * of 2, holding the entries it holds now.  Converts a linear
+ * directory, or doubles the table of a hashed one.  DIR is grown to
+ * its new size first, so that running out of disk space leaves it as
+ * it was.  Returns false if memory or a write fails. */
+static bool
+rehash (struct dir *dir, uint32_t bucket_cnt) {
+	struct dir_index *index = NULL;
+	struct dir_block *block = NULL;
+	struct dir_entry *entries;
+	size_t cnt, *first = NULL, i;
+	uint32_t b, blk, next_blk, block_cnt;
+	off_t length;
+	bool success = false;
+
+	ASSERT (bucket_cnt > 0 && (bucket_cnt & (bucket_cnt - 1)) == 0);
+
+	entries = read_entries (dir, &cnt);
+	if (entries == NULL)
+		return false;
+	index = calloc (1, sizeof *index);
+	block = malloc (sizeof *block);
+	first = calloc (bucket_cnt + 1, sizeof *first);
+	if (index == NULL || block == NULL || first == NULL)
+		goto done;
+	index->magic = DIR_INDEX_MAGIC;
+	index->bucket_cnt = bucket_cnt;
+	index->entry_cnt = cnt;
+
+	/* Sort the entries by bucket, counting how many go to each. */
+	for (i = 0; i < cnt; i++)
+		first[bucket_block (index, entries[i].name)]++;
+	for (b = 1; b <= bucket_cnt; b++)
+		first[b] += first[b - 1];
+	for (i = 0; i < cnt; ) {
+		b = bucket_block (index, entries[i].name) - 1;
+		if (i >= first[b] && i < first[b + 1])
+			i++;
+		else {
+			/* Swap entry I into the range of its bucket, behind those
+			 * already there. */
+			size_t j = first[b];
+			struct dir_entry tmp;
+
+			while (bucket_block (index, entries[j].name) - 1 == b)
+				j++;
+			tmp = entries[j];
+			entries[j] = entries[i];
+			entries[i] = tmp;
+		}
+	}
+
+	/* Grow DIR to hold the index, the buckets and their overflow
+	 * blocks before any of its blocks is overwritten. */
+	block_cnt = 1;
+	for (b = 0; b < bucket_cnt; b++) {
+		size_t n = first[b + 1] - first[b];
+
+		block_cnt += n > BLOCK_ENTRIES ? DIV_ROUND_UP (n, BLOCK_ENTRIES) : 1;
+	}
+	length = (off_t) block_cnt * DISK_SECTOR_SIZE;
+	if (inode_length (dir->inode) < length) {
+		uint8_t zero = 0;
+
+		if (inode_write_at (dir->inode, &zero, 1, length - 1) != 1)
+			goto done;
+	}
+
+	/* Write the buckets, and their overflow blocks after them. */
+	next_blk = bucket_cnt + 1;
+	for (b = 0; b < bucket_cnt; b++) {
+		i = first[b];
+		blk = b + 1;
+		do {
+			size_t n = first[b + 1] - i;
+
+			if (n > BLOCK_ENTRIES)
+				n = BLOCK_ENTRIES;
+			memset (block, 0, sizeof *block);
+			memcpy (block->entries, entries + i, n * sizeof *entries);
+			i += n;
+			block->next = i < first[b + 1] ? next_blk : 0;
+			if (!write_block (dir, blk, block))
+				goto done;
+			blk = block->next;
+			if (blk != 0)
+				next_blk++;
+		} while (blk != 0);
+	}
+	ASSERT (next_blk == block_cnt);
+	index->block_cnt = next_blk;
+	success = write_block (dir, 0, index);
+
+done:
+	free (first);
+	free (block);
+	free (index);
+	free (entries);
+	return success;
+}
+
+/* Adds an entry for NAME with INODE_SECTOR to DIR, a hashed directory
+ * with INDEX, which must not contain NAME yet.  The table is doubled
+ * first if it is full.  The entry goes to the first free slot of the
+ * bucket of NAME, or to a new overflow block.
+ * Returns true if successful, false on failure. */
+static bool
+hashed_add (struct dir *dir, struct dir_index *index, const char *name,
+		disk_sector_t inode_sector) {
+	struct dir_block block;
+	struct dir_entry e;
+	uint32_t blk;
+	off_t ofs = -1;
+	size_t i;
+
+	/* Keep the chains short. */
+	if (index->entry_cnt >= index->bucket_cnt * BLOCK_ENTRIES
+			&& (!rehash (dir, index->bucket_cnt * 2)
+				|| !read_index (dir, index)))
+		return false;
+
+	blk = bucket_block (index, name);
+	e.in_use = true;
+	strlcpy (e.name, name, sizeof e.name);
+	e.inode_sector = inode_sector;
+
+	for (;;) {
+		if (!read_block (dir, blk, &block))
+			return false;
+		for (i = 0; i < BLOCK_ENTRIES; i++)
+			if (!block.entries[i].in_use) {
+				ofs = entry_ofs (blk, i);
+				break;
+			}
+		if (ofs >= 0 || block.next == 0)
+			break;
+		blk = block.next;
+	}
+
+	if (ofs >= 0) {
+		if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
+			return false;
+	} else {
+		/* The bucket is full: chain a new overflow block to it.  Write
+		 * the new block first, as it may grow DIR, and link it only
+		 * once it is there. */
+		struct dir_block overflow;
+		uint32_t new = index->block_cnt;
+
+		memset (&overflow, 0, sizeof overflow);
+		overflow.entries[0] = e;
+		if (!write_block (dir, new, &overflow))
+			return false;
+		block.next = new;
+		if (!write_block (dir, blk, &block))
+			return false;
+		index->block_cnt++;
+	}
+
+	index->entry_cnt++;
+	return write_block (dir, 0, index);
+}
+
 /* Searches DIR for a file with the given NAME
  * and returns true if one exists, false otherwise.
  * On success, sets *INODE to an inode for the file, otherwise to
@@ -125,6 +441,7 @@ dir_lookup (const struct dir *dir, const char *name,
  * error occurs. */
 bool
 dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
+	struct dir_index index;
 	struct dir_entry e;
 	off_t ofs;
 	bool success = false;
@@ -140,6 +457,11 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 	if (lookup (dir, name, NULL, NULL))
 		goto done;
 
+	if (read_index (dir, &index)) {
+		success = hashed_add (dir, &index, name, inode_sector);
+		goto done;
+	}
+
 	/* Set OFS to offset of free slot.
 	 * If there are no free slots, then it will be set to the
 	 * current end-of-file.
@@ -152,6 +474,19 @@ dir_add (struct dir *dir, const char *name, disk_sector_t inode_sector) {
 		if (!e.in_use)
 			break;
 
+	/* A large directory that is full goes over to the hashed format,
+	 * with room for twice its entries. */
+	if (ofs / (off_t) sizeof e >= DIR_HASH_MIN) {
+		uint32_t bucket_cnt = 1;
+
+		while (bucket_cnt * BLOCK_ENTRIES < ofs / sizeof e)
+			bucket_cnt *= 2;
+		if (!rehash (dir, bucket_cnt * 2) || !read_index (dir, &index))
+			goto done;
+		success = hashed_add (dir, &index, name, inode_sector);
+		goto done;
+	}
+
 	/* Write slot. */
 	e.in_use = true;
 	strlcpy (e.name, name, sizeof e.name);
@@ -167,6 +502,7 @@ done:
  * which occurs only if there is no file with the given NAME. */
 bool
 dir_remove (struct dir *dir, const char *name) {
+	struct dir_index index;
 	struct dir_entry e;
 	struct inode *inode = NULL;
 	bool success = false;
@@ -188,6 +524,11 @@ dir_remove (struct dir *dir, const char *name) {
 	e.in_use = false;
 	if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e)
 		goto done;
+	if (read_index (dir, &index)) {
+		index.entry_cnt--;
+		if (!write_block (dir, 0, &index))
+			goto done;
+	}
 
 	/* Remove inode. */
 	inode_remove (inode);
@@ -200,11 +541,40 @@ done:
 
 /* Reads the next directory entry in DIR and stores the name in
  * NAME.  Returns true if successful, false if the directory
- * contains no more entries. */
+ * contains no more entries.  If names are added while DIR is being
+ * read and the directory is rehashed, the names after the current
+ * position are no longer those of the first pass: some may be skipped
+ * or returned twice. */
 bool
 dir_readdir (struct dir *dir, char name[NAME_MAX + 1]) {
+	struct dir_index index;
 	struct dir_entry e;
 
+	if (read_index (dir, &index)) {
+		/* Skip the index, and the tail of each block. */
+		for (;;) {
+			uint32_t blk = dir->pos / DISK_SECTOR_SIZE;
+
+			if (blk == 0) {
+				dir->pos = DISK_SECTOR_SIZE;
+				continue;
+			}
+			if (blk >= index.block_cnt)
+				return false;
+			if (dir->pos >= entry_ofs (blk, BLOCK_ENTRIES)) {
+				dir->pos = (blk + 1) * DISK_SECTOR_SIZE;
+				continue;
+			}
+			if (inode_read_at (dir->inode, &e, sizeof e, dir->pos) != sizeof e)
+				return false;
+			dir->pos += sizeof e;
+			if (e.in_use) {
+				strlcpy (name, e.name, NAME_MAX + 1);
+				return true;
+			}
+		}
+	}
+
 	while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) {
 		dir->pos += sizeof e;
 		if (e.in_use) {
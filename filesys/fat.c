@@ -1,4 +1,5 @@
 #include "filesys/fat.h"
+#include <bitmap.h>
 #include "devices/disk.h"
 #include "filesys/filesys.h"
 #include "threads/malloc.h"
@@ -24,12 +25,21 @@ struct fat_fs {
 	disk_sector_t data_start;
 	cluster_t last_clst;
 	struct lock write_lock;
+
+	/* Free-cluster index, so that allocation need not scan FAT. */
+	struct bitmap *used;        /* One bit per cluster, set if in use. */
+	size_t free_cnt;            /* Clusters not in use. */
+	cluster_t hint;             /* Where the next scan starts. */
+
+	struct bitmap *dirty;       /* FAT sectors changed since they were
+	                               last written. */
 };
 
 static struct fat_fs *fat_fs;
 
 void fat_boot_create (void);
 void fat_fs_init (void);
+static void fat_index_init (void);
 
 void
 fat_init (void) {
@@ -78,6 +88,26 @@ fat_open (void) {
 			free (bounce);
 		}
 	}
+	fat_index_init ();
+}
+
+/* Writes sector IDX of FAT to the disk. */
+static void
+fat_write_sector (unsigned idx) {
+	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
+	const off_t ofs = idx * DISK_SECTOR_SIZE;
+	uint8_t *buffer = (uint8_t *) fat_fs->fat;
+
+	if (fat_size_in_bytes - ofs >= DISK_SECTOR_SIZE)
+		disk_write (filesys_disk, fat_fs->bs.fat_start + idx, buffer + ofs);
+	else {
+		uint8_t *bounce = calloc (1, DISK_SECTOR_SIZE);
+		if (bounce == NULL)
+			PANIC ("FAT close failed");
+		memcpy (bounce, buffer + ofs, fat_size_in_bytes - ofs);
+		disk_write (filesys_disk, fat_fs->bs.fat_start + idx, bounce);
+		free (bounce);
+	}
 }
 
 void
@@ -90,27 +120,14 @@ fat_close (void) {
 	disk_write (filesys_disk, FAT_BOOT_SECTOR, bounce);
 	free (bounce);
 
-	// Write FAT directly to the disk
-	uint8_t *buffer = (uint8_t *) fat_fs->fat;
-	off_t bytes_wrote = 0;
-	off_t bytes_left = sizeof (fat_fs->fat);
-	const off_t fat_size_in_bytes = fat_fs->fat_length * sizeof (cluster_t);
-	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++) {
-		bytes_left = fat_size_in_bytes - bytes_wrote;
-		if (bytes_left >= DISK_SECTOR_SIZE) {
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i,
-			            buffer + bytes_wrote);
-			bytes_wrote += DISK_SECTOR_SIZE;
-		} else {
-			bounce = calloc (1, DISK_SECTOR_SIZE);
-			if (bounce == NULL)
-				PANIC ("FAT close failed");
-			memcpy (bounce, buffer + bytes_wrote, bytes_left);
-			disk_write (filesys_disk, fat_fs->bs.fat_start + i, bounce);
-			bytes_wrote += bytes_left;
-			free (bounce);
+	// Write the FAT sectors that changed since the last time
+	lock_acquire (&fat_fs->write_lock);
+	for (unsigned i = 0; i < fat_fs->bs.fat_sectors; i++)
+		if (bitmap_test (fat_fs->dirty, i)) {
+			fat_write_sector (i);
+			bitmap_reset (fat_fs->dirty, i);
 		}
-	}
+	lock_release (&fat_fs->write_lock);
 }
 
 void
@@ -123,6 +140,10 @@ fat_create (void) {
 	fat_fs->fat = calloc (fat_fs->fat_length, sizeof (cluster_t));
 	if (fat_fs->fat == NULL)
 		PANIC ("FAT creation failed");
+	fat_index_init ();
+
+	// The whole new table goes to the disk
+	bitmap_set_all (fat_fs->dirty, true);
 
 	// Set up ROOT_DIR_CLST
 	fat_put (ROOT_DIR_CLUSTER, EOChain);
@@ -152,42 +173,134 @@ fat_boot_create (void) {
 
 void
 fat_fs_init (void) {
-	/* TODO: Your code goes here. */
+	/* Clusters follow FAT on the disk.  Cluster 0 stands for "no
+	 * cluster", so the first data cluster is 1. */
+	fat_fs->data_start = fat_fs->bs.fat_start + fat_fs->bs.fat_sectors;
+	fat_fs->fat_length = (fat_fs->bs.total_sectors - fat_fs->data_start)
+		/ SECTORS_PER_CLUSTER + 1;
+	fat_fs->last_clst = fat_fs->fat_length - 1;
+	lock_init (&fat_fs->write_lock);
+}
+
+/* Builds the free-cluster index from FAT, and the map of dirty FAT
+ * sectors, all clean. */
+static void
+fat_index_init (void) {
+	cluster_t clst;
+
+	fat_fs->used = bitmap_create (fat_fs->fat_length);
+	fat_fs->dirty = bitmap_create (fat_fs->bs.fat_sectors);
+	if (fat_fs->used == NULL || fat_fs->dirty == NULL)
+		PANIC ("FAT index creation failed");
+
+	bitmap_mark (fat_fs->used, 0);
+	fat_fs->free_cnt = 0;
+	for (clst = 1; clst < fat_fs->fat_length; clst++)
+		if (fat_fs->fat[clst] != 0)
+			bitmap_mark (fat_fs->used, clst);
+		else
+			fat_fs->free_cnt++;
+	fat_fs->hint = 1;
 }
 
 /*----------------------------------------------------------------------------*/
 /* FAT handling                                                               */
 /*----------------------------------------------------------------------------*/
 
+/* Sets entry CLST of FAT to VAL and marks its sector dirty.
+ * Caller must hold the write lock. */
+static void
+fat_set (cluster_t clst, cluster_t val) {
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+
+	fat_fs->fat[clst] = val;
+	bitmap_mark (fat_fs->dirty,
+			clst * sizeof (cluster_t) / DISK_SECTOR_SIZE);
+}
+
+/* Takes a free cluster off the index and returns it, or 0 if there is
+ * none.  The scan starts after the cluster allocated last, so that
+ * chains grown together come out contiguous.
+ * Caller must hold the write lock. */
+static cluster_t
+fat_alloc_cluster (void) {
+	size_t clst;
+
+	if (fat_fs->free_cnt == 0)
+		return 0;
+	clst = bitmap_scan_and_flip (fat_fs->used, fat_fs->hint, 1, false);
+	if (clst == BITMAP_ERROR)
+		clst = bitmap_scan_and_flip (fat_fs->used, 1, 1, false);
+	ASSERT (clst != BITMAP_ERROR);
+
+	fat_fs->free_cnt--;
+	fat_fs->hint = clst + 1 < fat_fs->fat_length ? clst + 1 : 1;
+	return clst;
+}
+
 /* Add a cluster to the chain.
  * If CLST is 0, start a new chain.
  * Returns 0 if fails to allocate a new cluster. */
 cluster_t
 fat_create_chain (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	cluster_t new;
+
+	lock_acquire (&fat_fs->write_lock);
+	new = fat_alloc_cluster ();
+	if (new != 0) {
+		fat_set (new, EOChain);
+		if (clst != 0)
+			fat_set (clst, new);
+	}
+	lock_release (&fat_fs->write_lock);
+	return new;
 }
 
 /* Remove the chain of clusters starting from CLST.
  * If PCLST is 0, assume CLST as the start of the chain. */
 void
 fat_remove_chain (cluster_t clst, cluster_t pclst) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (pclst != 0)
+		fat_set (pclst, EOChain);
+	while (clst != 0 && clst != EOChain) {
+		cluster_t next = fat_fs->fat[clst];
+
+		fat_set (clst, 0);
+		bitmap_reset (fat_fs->used, clst);
+		fat_fs->free_cnt++;
+		clst = next;
+	}
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Update a value in the FAT table. */
 void
 fat_put (cluster_t clst, cluster_t val) {
-	/* TODO: Your code goes here. */
+	lock_acquire (&fat_fs->write_lock);
+	if (val != 0 && !bitmap_test (fat_fs->used, clst)) {
+		bitmap_mark (fat_fs->used, clst);
+		fat_fs->free_cnt--;
+	} else if (val == 0 && bitmap_test (fat_fs->used, clst)) {
+		bitmap_reset (fat_fs->used, clst);
+		fat_fs->free_cnt++;
+	}
+	fat_set (clst, val);
+	lock_release (&fat_fs->write_lock);
 }
 
 /* Fetch a value in the FAT table. */
 cluster_t
 fat_get (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+
+	return fat_fs->fat[clst];
 }
 
 /* Covert a cluster # to a sector number. */
 disk_sector_t
 cluster_to_sector (cluster_t clst) {
-	/* TODO: Your code goes here. */
+	ASSERT (clst > 0 && clst < fat_fs->fat_length);
+
+	return fat_fs->data_start + (clst - 1) * SECTORS_PER_CLUSTER;
 }
@@ -1,12 +1,18 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 
+/* Bits of the free map in one sector of its file. */
+#define BITS_PER_SECTOR (DISK_SECTOR_SIZE * 8)
+
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per disk sector. */
+static struct bitmap *dirty_map;     /* Sectors of the free map file that
+                                        changed since they were written. */
 
 /* Initializes the free map. */
 void
@@ -14,10 +20,46 @@ free_map_init (void) {
 	free_map = bitmap_create (disk_size (filesys_disk));
 	if (free_map == NULL)
 		PANIC ("bitmap creation failed--disk is too large");
+	dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+				DISK_SECTOR_SIZE));
+	if (dirty_map == NULL)
+		PANIC ("bitmap creation failed--disk is too large");
 	bitmap_mark (free_map, FREE_MAP_SECTOR);
 	bitmap_mark (free_map, ROOT_DIR_SECTOR);
 }
 
+/* Marks the sectors of the free map file that hold the bits of the CNT
+ * sectors from SECTOR on as changed. */
+static void
+mark_dirty (disk_sector_t sector, size_t cnt) {
+	size_t first = sector / BITS_PER_SECTOR;
+	size_t last = (sector + cnt - 1) / BITS_PER_SECTOR;
+
+	bitmap_set_multiple (dirty_map, first, last - first + 1, true);
+}
+
+/* Writes the sectors of the free map file that changed since they were
+ * last written, and only those.  They go to the buffer cache, which
+ * writes them to disk with its write-behind, but always before any
+ * later change to the same sectors.  Returns false if a write failed;
+ * the sectors that were not written stay marked. */
+static bool
+free_map_flush (void) {
+	size_t i;
+
+	if (free_map_file == NULL)
+		return true;
+	for (i = 0; i < bitmap_size (dirty_map); i++) {
+		if (!bitmap_test (dirty_map, i))
+			continue;
+		if (!bitmap_write_part (free_map, free_map_file,
+					i * DISK_SECTOR_SIZE, DISK_SECTOR_SIZE))
+			return false;
+		bitmap_reset (dirty_map, i);
+	}
+	return true;
+}
+
 /* Allocates CNT consecutive sectors from the free map and stores
  * the first into *SECTORP.
  * Returns true if successful, false if all sectors were
@@ -25,23 +67,85 @@ free_map_init (void) {
 bool
 free_map_allocate (size_t cnt, disk_sector_t *sectorp) {
 	disk_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-	if (sector != BITMAP_ERROR
-			&& free_map_file != NULL
-			&& !bitmap_write (free_map, free_map_file)) {
-		bitmap_set_multiple (free_map, sector, cnt, false);
-		sector = BITMAP_ERROR;
+	if (sector != BITMAP_ERROR) {
+		mark_dirty (sector, cnt);
+		if (!free_map_flush ()) {
+			bitmap_set_multiple (free_map, sector, cnt, false);
+			sector = BITMAP_ERROR;
+		}
 	}
 	if (sector != BITMAP_ERROR)
 		*sectorp = sector;
 	return sector != BITMAP_ERROR;
 }
 
-/* Makes CNT sectors starting at SECTOR available for use. */
+/* Returns the number of free sectors from START on, at most CNT. */
+static size_t
+free_run_length (size_t start, size_t cnt) {
+	size_t bit_cnt = bitmap_size (free_map);
+	size_t len = 0;
+
+	while (len < cnt && start + len < bit_cnt
+			&& !bitmap_test (free_map, start + len))
+		len++;
+	return len;
+}
+
+/* Allocates a run of at most CNT consecutive sectors and stores the
+ * first into *SECTORP.  The run starts at HINT if that sector is free,
+ * so that a growing file stays contiguous; otherwise it is the first
+ * run of CNT free sectors, or failing that the largest free run.
+ * Returns the number of sectors allocated, 0 if the disk is full. */
+size_t
+free_map_allocate_run (size_t cnt, disk_sector_t hint,
+		disk_sector_t *sectorp) {
+	size_t bit_cnt = bitmap_size (free_map);
+	size_t best = 0, best_len = 0;
+
+	ASSERT (cnt > 0);
+
+	if (hint < bit_cnt && !bitmap_test (free_map, hint)) {
+		best = hint;
+		best_len = free_run_length (hint, cnt);
+	} else {
+		size_t pos = 0;
+
+		while (best_len < cnt) {
+			size_t len;
+
+			pos = bitmap_scan (free_map, pos, 1, false);
+			if (pos == BITMAP_ERROR)
+				break;
+			len = free_run_length (pos, cnt);
+			if (len > best_len) {
+				best = pos;
+				best_len = len;
+			}
+			pos += len;
+		}
+	}
+	if (best_len == 0)
+		return 0;
+
+	bitmap_set_multiple (free_map, best, best_len, true);
+	mark_dirty (best, best_len);
+	if (!free_map_flush ()) {
+		bitmap_set_multiple (free_map, best, best_len, false);
+		return 0;
+	}
+	*sectorp = best;
+	return best_len;
+}
+
+/* Makes CNT sectors starting at SECTOR available for use.  The caller
+ * must have dropped every reference to them already, so that the free
+ * map never shows a sector free that the disk still uses. */
 void
 free_map_release (disk_sector_t sector, size_t cnt) {
 	ASSERT (bitmap_all (free_map, sector, cnt));
 	bitmap_set_multiple (free_map, sector, cnt, false);
-	bitmap_write (free_map, free_map_file);
+	mark_dirty (sector, cnt);
+	free_map_flush ();
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -57,6 +161,7 @@ free_map_open (void) {
 /* Writes the free map to disk and closes the free map file. */
 void
 free_map_close (void) {
+	free_map_flush ();
 	file_close (free_map_file);
 }
 
@@ -74,4 +179,5 @@ free_map_create (void) {
 		PANIC ("can't open free map");
 	if (!bitmap_write (free_map, free_map_file))
 		PANIC ("can't write free map");
+	bitmap_set_all (dirty_map, false);
 }
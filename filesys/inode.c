@@ -3,20 +3,50 @@
 #include <debug.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#ifdef VM
+#include "filesys/page_cache.h"
+#endif
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of sectors, consecutive on disk, that holds file data. */
+struct extent {
+	disk_sector_t start;                /* First sector of the run. */
+	uint32_t length;                    /* Number of sectors. */
+};
+
+/* Number of extents in the inode itself, and in each indirect extent
+ * block. */
+#define DIRECT_EXTENTS 60
+#define BLOCK_EXTENTS 63
+
 /* On-disk inode.
- * Must be exactly DISK_SECTOR_SIZE bytes long. */
+ * Must be exactly DISK_SECTOR_SIZE bytes long.
+ * The data of the file lies in a list of extents, in file order.  The
+ * first DIRECT_EXTENTS of them are here, the rest in a chain of
+ * indirect extent blocks. */
 struct inode_disk {
-	disk_sector_t start;                /* First data sector. */
 	off_t length;                       /* File size in bytes. */
 	unsigned magic;                     /* Magic number. */
-	uint32_t unused[125];               /* Not used. */
+	uint32_t extent_cnt;                /* Number of extents. */
+	disk_sector_t indirect;             /* First indirect extent block,
+	                                       0 if none. */
+	struct extent extents[DIRECT_EXTENTS];  /* First extents. */
+	uint32_t unused[4];                 /* Not used. */
+};
+
+/* Indirect extent block.
+ * Must be exactly DISK_SECTOR_SIZE bytes long. */
+struct extent_block {
+	struct extent extents[BLOCK_EXTENTS];   /* Next extents. */
+	disk_sector_t next;                 /* Next block, 0 if none. */
+	uint32_t unused;                    /* Not used. */
 };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -34,19 +64,75 @@ struct inode {
 	bool removed;                       /* True if deleted, false otherwise. */
 	int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
 	struct inode_disk data;             /* Inode content. */
+
+	/* The whole extent list, kept in memory while the inode is open.
+	 * Extents are only ever appended or lengthened at the end, so the
+	 * position of an extent in the file never changes. */
+	struct lock lock;                   /* Protects the extent list, and
+	                                       serializes writes that grow
+	                                       the file. */
+	struct extent *extents;             /* Every extent, in file order. */
+	size_t extent_cap;                  /* Room in EXTENTS. */
+	disk_sector_t *blocks;              /* Indirect extent blocks. */
+	size_t block_cnt;                   /* Number of BLOCKS. */
+	size_t sector_cnt;                  /* Sectors in all extents. */
+	size_t hint;                        /* Extent of the last lookup. */
+	size_t hint_first;                  /* First file sector of HINT. */
+	off_t read_end;                     /* Where the last read ended. */
+	bool cached;                        /* Data goes through the page
+	                                       cache. */
 };
 
 /* Returns the disk sector that contains byte offset POS within
- * INODE.
- * Returns -1 if INODE does not contain data for a byte at offset
- * POS. */
+ * INODE, and stores in *RUN the number of sectors from there to the
+ * end of its extent, which may be read or written with one command.
+ * Returns -1 if INODE has no sector allocated for offset POS. */
 static disk_sector_t
-byte_to_sector (const struct inode *inode, off_t pos) {
+byte_to_sector (struct inode *inode, off_t pos, size_t *run) {
+	size_t sector = pos / DISK_SECTOR_SIZE;
+	disk_sector_t result = -1;
+	bool locked;
+	size_t i = 0, first = 0;
+
 	ASSERT (inode != NULL);
-	if (pos < inode->data.length)
-		return inode->data.start + pos / DISK_SECTOR_SIZE;
-	else
-		return -1;
+	ASSERT (pos >= 0);
+
+	locked = lock_held_by_current_thread (&inode->lock);
+	if (!locked)
+		lock_acquire (&inode->lock);
+
+	/* Sequential access stays in the extent of the last lookup, or
+	 * moves on to the next one. */
+	if (sector >= inode->hint_first) {
+		i = inode->hint;
+		first = inode->hint_first;
+	}
+	for (; i < inode->data.extent_cnt; i++) {
+		const struct extent *e = &inode->extents[i];
+
+		if (sector < first + e->length) {
+			result = e->start + (sector - first);
+			*run = first + e->length - sector;
+			inode->hint = i;
+			inode->hint_first = first;
+			break;
+		}
+		first += e->length;
+	}
+
+	if (!locked)
+		lock_release (&inode->lock);
+	return result;
+}
+
+/* Returns the number of whole sectors that may be moved together
+ * when RUN sectors are left in the extent and SIZE bytes are left to
+ * move. */
+static size_t
+io_sectors (size_t run, off_t size) {
+	size_t cnt = size / DISK_SECTOR_SIZE;
+
+	return cnt < run ? cnt : run;
 }
 
 /* List of open inodes, so that opening a single inode twice
@@ -59,6 +145,232 @@ inode_init (void) {
 	list_init (&open_inodes);
 }
 
+/* Returns a new in-memory inode for SECTOR, with no extents, or a null
+ * pointer if memory allocation fails. */
+static struct inode *
+inode_alloc (disk_sector_t sector) {
+	struct inode *inode = calloc (1, sizeof *inode);
+
+	if (inode == NULL)
+		return NULL;
+	inode->extents = malloc (DIRECT_EXTENTS * sizeof *inode->extents);
+	if (inode->extents == NULL) {
+		free (inode);
+		return NULL;
+	}
+	inode->extent_cap = DIRECT_EXTENTS;
+	inode->sector = sector;
+	lock_init (&inode->lock);
+	return inode;
+}
+
+/* Frees INODE and its extent list. */
+static void
+inode_free (struct inode *inode) {
+	free (inode->extents);
+	free (inode->blocks);
+	free (inode);
+}
+
+/* Reads the on-disk inode of INODE and its indirect extent blocks.
+ * Returns false if memory allocation fails. */
+static bool
+inode_load (struct inode *inode) {
+	struct inode_disk *data = &inode->data;
+	struct extent_block *block = NULL;
+	disk_sector_t next;
+	size_t i, done;
+
+	cache_read (inode->sector, data, 0, DISK_SECTOR_SIZE);
+	if (data->extent_cnt > inode->extent_cap) {
+		struct extent *extents = realloc (inode->extents,
+				data->extent_cnt * sizeof *extents);
+
+		if (extents == NULL)
+			return false;
+		inode->extents = extents;
+		inode->extent_cap = data->extent_cnt;
+	}
+
+	done = data->extent_cnt < DIRECT_EXTENTS
+		? data->extent_cnt : DIRECT_EXTENTS;
+	memcpy (inode->extents, data->extents, done * sizeof *inode->extents);
+
+	if (done < data->extent_cnt) {
+		inode->block_cnt = DIV_ROUND_UP (data->extent_cnt - done,
+				BLOCK_EXTENTS);
+		inode->blocks = malloc (inode->block_cnt * sizeof *inode->blocks);
+		block = malloc (sizeof *block);
+		if (inode->blocks == NULL || block == NULL) {
+			free (block);
+			return false;
+		}
+	}
+	for (i = 0, next = data->indirect; done < data->extent_cnt; i++) {
+		size_t cnt = data->extent_cnt - done;
+
+		if (cnt > BLOCK_EXTENTS)
+			cnt = BLOCK_EXTENTS;
+		ASSERT (next != 0);
+		inode->blocks[i] = next;
+		cache_read (next, block, 0, DISK_SECTOR_SIZE);
+		memcpy (inode->extents + done, block->extents,
+				cnt * sizeof *inode->extents);
+		done += cnt;
+		next = block->next;
+	}
+	free (block);
+
+	for (i = 0; i < data->extent_cnt; i++)
+		inode->sector_cnt += inode->extents[i].length;
+	return true;
+}
+
+/* Writes the on-disk inode of INODE, and those of its indirect extent
+ * blocks that hold extents from FIRST on, to disk.  Returns false if
+ * memory allocation fails. */
+static bool
+inode_store (struct inode *inode, size_t first) {
+	struct inode_disk *data = &inode->data;
+	struct extent_block *block;
+	size_t direct, b;
+
+	direct = data->extent_cnt < DIRECT_EXTENTS
+		? data->extent_cnt : DIRECT_EXTENTS;
+	memcpy (data->extents, inode->extents, direct * sizeof *data->extents);
+	data->indirect = inode->block_cnt > 0 ? inode->blocks[0] : 0;
+	cache_write (inode->sector, data, 0, DISK_SECTOR_SIZE);
+
+	if (inode->block_cnt == 0)
+		return true;
+	block = calloc (1, sizeof *block);
+	if (block == NULL)
+		return false;
+	b = first < DIRECT_EXTENTS ? 0 : (first - DIRECT_EXTENTS) / BLOCK_EXTENTS;
+	for (; b < inode->block_cnt; b++) {
+		size_t base = DIRECT_EXTENTS + b * BLOCK_EXTENTS;
+		size_t cnt = data->extent_cnt - base;
+
+		if (cnt > BLOCK_EXTENTS)
+			cnt = BLOCK_EXTENTS;
+		memset (block, 0, sizeof *block);
+		memcpy (block->extents, inode->extents + base,
+				cnt * sizeof *block->extents);
+		block->next = b + 1 < inode->block_cnt ? inode->blocks[b + 1] : 0;
+		cache_write (inode->blocks[b], block, 0, DISK_SECTOR_SIZE);
+	}
+	free (block);
+	return true;
+}
+
+/* Appends the CNT sectors from START on to the data of INODE, merging
+ * them into the last extent if they follow it on disk.  Returns false
+ * if memory or an indirect extent block cannot be allocated. */
+static bool
+extent_append (struct inode *inode, disk_sector_t start, size_t cnt) {
+	struct inode_disk *data = &inode->data;
+	struct extent *last = data->extent_cnt > 0
+		? &inode->extents[data->extent_cnt - 1] : NULL;
+
+	if (last != NULL && last->start + last->length == start) {
+		last->length += cnt;
+		inode->sector_cnt += cnt;
+		return true;
+	}
+
+	if (data->extent_cnt == inode->extent_cap) {
+		struct extent *extents = realloc (inode->extents,
+				2 * inode->extent_cap * sizeof *extents);
+
+		if (extents == NULL)
+			return false;
+		inode->extents = extents;
+		inode->extent_cap *= 2;
+	}
+	if (data->extent_cnt
+			== DIRECT_EXTENTS + inode->block_cnt * BLOCK_EXTENTS) {
+		disk_sector_t *blocks = realloc (inode->blocks,
+				(inode->block_cnt + 1) * sizeof *blocks);
+
+		if (blocks == NULL)
+			return false;
+		inode->blocks = blocks;
+		if (!free_map_allocate (1, &blocks[inode->block_cnt]))
+			return false;
+		inode->block_cnt++;
+	}
+
+	inode->extents[data->extent_cnt].start = start;
+	inode->extents[data->extent_cnt].length = cnt;
+	data->extent_cnt++;
+	inode->sector_cnt += cnt;
+	return true;
+}
+
+/* Allocates sectors to INODE until it has SECTORS of them, taking the
+ * longest free runs the free map has, and writes the extent list back.
+ * The new sectors are zeroed, except file sectors KEEP_FIRST up to
+ * KEEP_END, which the caller is about to overwrite entirely.  Returns
+ * false if the disk fills up; the sectors allocated until then stay
+ * with INODE. */
+static bool
+inode_grow (struct inode *inode, size_t sectors,
+		size_t keep_first, size_t keep_end) {
+	struct inode_disk *data = &inode->data;
+	size_t first = data->extent_cnt > 0 ? data->extent_cnt - 1 : 0;
+	bool success = true;
+
+	while (inode->sector_cnt < sectors) {
+		size_t file_sector = inode->sector_cnt;
+		disk_sector_t hint = 0, start;
+		size_t cnt, i, n;
+
+		/* Continue the last extent if the sectors after it are free. */
+		if (data->extent_cnt > 0) {
+			const struct extent *last = &inode->extents[data->extent_cnt - 1];
+			hint = last->start + last->length;
+		}
+		cnt = free_map_allocate_run (sectors - inode->sector_cnt, hint, &start);
+		if (cnt == 0) {
+			success = false;
+			break;
+		}
+		if (!extent_append (inode, start, cnt)) {
+			free_map_release (start, cnt);
+			success = false;
+			break;
+		}
+
+		for (i = 0; i < cnt; i += n) {
+			size_t s = file_sector + i, end = file_sector + cnt;
+
+			if (s >= keep_first && s < keep_end) {
+				n = (keep_end < end ? keep_end : end) - s;
+				continue;
+			}
+			if (s < keep_first && keep_first < end)
+				end = keep_first;
+			n = end - s;
+			cache_write_run (start + i, NULL, n);
+		}
+	}
+
+	if (!inode_store (inode, first))
+		success = false;
+	return success;
+}
+
+/* Releases the data sectors and indirect extent blocks of INODE. */
+static void
+inode_release (struct inode *inode) {
+	size_t i;
+
+	for (i = 0; i < inode->data.extent_cnt; i++)
+		free_map_release (inode->extents[i].start, inode->extents[i].length);
+	for (i = 0; i < inode->block_cnt; i++)
+		free_map_release (inode->blocks[i], 1);
+}
+
 /* Initializes an inode with LENGTH bytes of data and
  * writes the new inode to sector SECTOR on the file system
  * disk.
@@ -66,33 +378,25 @@ inode_init (void) {
  * Returns false if memory or disk allocation fails. */
 bool
 inode_create (disk_sector_t sector, off_t length) {
-	struct inode_disk *disk_inode = NULL;
-	bool success = false;
+	struct inode *inode;
+	bool success;
 
 	ASSERT (length >= 0);
 
 	/* If this assertion fails, the inode structure is not exactly
 	 * one sector in size, and you should fix that. */
-	ASSERT (sizeof *disk_inode == DISK_SECTOR_SIZE);
-
-	disk_inode = calloc (1, sizeof *disk_inode);
-	if (disk_inode != NULL) {
-		size_t sectors = bytes_to_sectors (length);
-		disk_inode->length = length;
-		disk_inode->magic = INODE_MAGIC;
-		if (free_map_allocate (sectors, &disk_inode->start)) {
-			disk_write (filesys_disk, sector, disk_inode);
-			if (sectors > 0) {
-				static char zeros[DISK_SECTOR_SIZE];
-				size_t i;
-
-				for (i = 0; i < sectors; i++) 
-					disk_write (filesys_disk, disk_inode->start + i, zeros); 
-			}
-			success = true; 
-		} 
-		free (disk_inode);
-	}
+	ASSERT (sizeof (struct inode_disk) == DISK_SECTOR_SIZE);
+	ASSERT (sizeof (struct extent_block) == DISK_SECTOR_SIZE);
+
+	inode = inode_alloc (sector);
+	if (inode == NULL)
+		return false;
+	inode->data.length = length;
+	inode->data.magic = INODE_MAGIC;
+	success = inode_grow (inode, bytes_to_sectors (length), 0, 0);
+	if (!success)
+		inode_release (inode);
+	inode_free (inode);
 	return success;
 }
 
@@ -115,17 +419,19 @@ inode_open (disk_sector_t sector) {
 	}
 
 	/* Allocate memory. */
-	inode = malloc (sizeof *inode);
+	inode = inode_alloc (sector);
 	if (inode == NULL)
 		return NULL;
+	if (!inode_load (inode)) {
+		inode_free (inode);
+		return NULL;
+	}
 
 	/* Initialize. */
 	list_push_front (&open_inodes, &inode->elem);
-	inode->sector = sector;
 	inode->open_cnt = 1;
 	inode->deny_write_cnt = 0;
 	inode->removed = false;
-	disk_read (filesys_disk, inode->sector, &inode->data);
 	return inode;
 }
 
@@ -157,14 +463,20 @@ inode_close (struct inode *inode) {
 		/* Remove from inode list and release lock. */
 		list_remove (&inode->elem);
 
+#ifdef VM
+		/* The data of a removed file need not be written back. */
+		if (inode->cached)
+			page_cache_drop (inode, inode->sector_cnt * DISK_SECTOR_SIZE,
+					!inode->removed);
+#endif
+
 		/* Deallocate blocks if removed. */
 		if (inode->removed) {
 			free_map_release (inode->sector, 1);
-			free_map_release (inode->data.start,
-					bytes_to_sectors (inode->data.length)); 
+			inode_release (inode);
 		}
 
-		free (inode); 
+		inode_free (inode);
 	}
 }
 
@@ -176,18 +488,34 @@ inode_remove (struct inode *inode) {
 	inode->removed = true;
 }
 
-/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+/* Makes the data of INODE go through the page cache from now on, where
+ * file mappings share it.  Without VM, or for an inode that is never
+ * marked this way, such as a directory, the data goes straight through
+ * the buffer cache. */
+void
+inode_use_page_cache (struct inode *inode) {
+#ifdef VM
+	inode->cached = true;
+#else
+	(void) inode;
+#endif
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET,
+ * through the buffer cache, bypassing the page cache.
  * Returns the number of bytes actually read, which may be less
- * than SIZE if an error occurs or end of file is reached. */
+ * than SIZE if an error occurs or end of file is reached.
+ * Whole sectors that lie together in one extent are read as a run. */
 off_t
-inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
+inode_read_disk (struct inode *inode, void *buffer_, off_t size,
+		off_t offset) {
 	uint8_t *buffer = buffer_;
 	off_t bytes_read = 0;
-	uint8_t *bounce = NULL;
 
 	while (size > 0) {
 		/* Disk sector to read, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		size_t run;
+		disk_sector_t sector_idx = byte_to_sector (inode, offset, &run);
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
@@ -201,52 +529,73 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset) {
 			break;
 
 		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Read full sector directly into caller's buffer. */
-			disk_read (filesys_disk, sector_idx, buffer + bytes_read); 
-		} else {
-			/* Read sector into bounce buffer, then partially copy
-			 * into caller's buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
-			disk_read (filesys_disk, sector_idx, bounce);
-			memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-		}
+			/* Read full sectors directly into caller's buffer. */
+			size_t cnt = io_sectors (run, size < inode_left ? size : inode_left);
+
+			cache_read_run (sector_idx, buffer + bytes_read, cnt);
+			chunk_size = cnt * DISK_SECTOR_SIZE;
+		} else
+			cache_read (sector_idx, buffer + bytes_read, sector_ofs, chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_read += chunk_size;
 	}
-	free (bounce);
+	return bytes_read;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
+ * Returns the number of bytes actually read, which may be less
+ * than SIZE if an error occurs or end of file is reached.
+ * A read that continues the previous one reads ahead: the pages after
+ * it if INODE goes through the page cache, the sector after it
+ * otherwise. */
+off_t
+inode_read_at (struct inode *inode, void *buffer, off_t size, off_t offset) {
+	bool sequential = offset == inode->read_end;
+	off_t bytes_read;
+
+#ifdef VM
+	if (inode->cached) {
+		bytes_read = page_cache_read (inode, buffer, size, offset, sequential);
+		inode->read_end = offset + bytes_read;
+		return bytes_read;
+	}
+#endif
+
+	bytes_read = inode_read_disk (inode, buffer, size, offset);
+	offset += bytes_read;
+	inode->read_end = offset;
+	if (sequential && bytes_read > 0) {
+		off_t next = ROUND_UP (offset, DISK_SECTOR_SIZE);
+		size_t run;
 
+		if (next < inode_length (inode))
+			cache_readahead (byte_to_sector (inode, next, &run));
+	}
 	return bytes_read;
 }
 
-/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
- * Returns the number of bytes actually written, which may be
- * less than SIZE if end of file is reached or an error occurs.
- * (Normally a write at end of file would extend the inode, but
- * growth is not yet implemented.) */
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET, through
+ * the buffer cache, bypassing the page cache.  Bytes past the sectors
+ * allocated to INODE are not written.  Returns the number of bytes
+ * actually written. */
 off_t
-inode_write_at (struct inode *inode, const void *buffer_, off_t size,
+inode_write_disk (struct inode *inode, const void *buffer_, off_t size,
 		off_t offset) {
 	const uint8_t *buffer = buffer_;
 	off_t bytes_written = 0;
-	uint8_t *bounce = NULL;
-
-	if (inode->deny_write_cnt)
-		return 0;
+	off_t end = inode->sector_cnt * DISK_SECTOR_SIZE;
 
 	while (size > 0) {
 		/* Sector to write, starting byte offset within sector. */
-		disk_sector_t sector_idx = byte_to_sector (inode, offset);
+		size_t run;
+		disk_sector_t sector_idx;
 		int sector_ofs = offset % DISK_SECTOR_SIZE;
 
 		/* Bytes left in inode, bytes left in sector, lesser of the two. */
-		off_t inode_left = inode_length (inode) - offset;
+		off_t inode_left = end - offset;
 		int sector_left = DISK_SECTOR_SIZE - sector_ofs;
 		int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -255,35 +604,77 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 		if (chunk_size <= 0)
 			break;
 
+		sector_idx = byte_to_sector (inode, offset, &run);
 		if (sector_ofs == 0 && chunk_size == DISK_SECTOR_SIZE) {
-			/* Write full sector directly to disk. */
-			disk_write (filesys_disk, sector_idx, buffer + bytes_written); 
-		} else {
-			/* We need a bounce buffer. */
-			if (bounce == NULL) {
-				bounce = malloc (DISK_SECTOR_SIZE);
-				if (bounce == NULL)
-					break;
-			}
+			/* Write full sectors, without reading them first. */
+			size_t cnt = io_sectors (run, size < inode_left ? size : inode_left);
 
-			/* If the sector contains data before or after the chunk
-			   we're writing, then we need to read in the sector
-			   first.  Otherwise we start with a sector of all zeros. */
-			if (sector_ofs > 0 || chunk_size < sector_left) 
-				disk_read (filesys_disk, sector_idx, bounce);
-			else
-				memset (bounce, 0, DISK_SECTOR_SIZE);
-			memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-			disk_write (filesys_disk, sector_idx, bounce); 
-		}
+			cache_write_run (sector_idx, buffer + bytes_written, cnt);
+			chunk_size = cnt * DISK_SECTOR_SIZE;
+		} else
+			cache_write (sector_idx, buffer + bytes_written, sector_ofs,
+					chunk_size);
 
 		/* Advance. */
 		size -= chunk_size;
 		offset += chunk_size;
 		bytes_written += chunk_size;
 	}
-	free (bounce);
+	return bytes_written;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
+ * Returns the number of bytes actually written, which may be
+ * less than SIZE if the disk fills up or an error occurs.
+ * A write past end of file extends the inode.  It holds the inode
+ * lock, so that writes extending the file do not race, and readers see
+ * the new length only once the data is there.  A write through the
+ * page cache copies the data with the lock released, because evicting
+ * a page of the cache to make room looks sectors up in the inode it
+ * belongs to. */
+off_t
+inode_write_at (struct inode *inode, const void *buffer, off_t size,
+		off_t offset) {
+	off_t bytes_written;
+	off_t end = offset + size;
+	bool extend;
 
+	if (inode->deny_write_cnt)
+		return 0;
+
+	extend = size > 0 && end > inode_length (inode);
+	if (extend) {
+		lock_acquire (&inode->lock);
+		/* Sectors the write covers entirely need not be zeroed.  If the
+		 * disk fills up, write what fits. */
+		if (!inode_grow (inode, bytes_to_sectors (end),
+					DIV_ROUND_UP (offset, DISK_SECTOR_SIZE),
+					end / DISK_SECTOR_SIZE)
+				&& end > (off_t) (inode->sector_cnt * DISK_SECTOR_SIZE))
+			end = inode->sector_cnt * DISK_SECTOR_SIZE;
+	} else
+		end = inode_length (inode);
+	if (size > end - offset)
+		size = end > offset ? end - offset : 0;
+
+#ifdef VM
+	if (inode->cached) {
+		if (extend)
+			lock_release (&inode->lock);
+		bytes_written = page_cache_write (inode, buffer, size, offset);
+		if (extend)
+			lock_acquire (&inode->lock);
+	} else
+#endif
+		bytes_written = inode_write_disk (inode, buffer, size, offset);
+
+	if (extend) {
+		if (offset + bytes_written > inode->data.length) {
+			inode->data.length = offset + bytes_written;
+			cache_write (inode->sector, &inode->data, 0, DISK_SECTOR_SIZE);
+		}
+		lock_release (&inode->lock);
+	}
 	return bytes_written;
 }
 
@@ -1,6 +1,35 @@
-/* page_cache.c: Implementation of Page Cache (Buffer Cache). */
+/* page_cache.c: Page cache of file data.
+ *
+ * The data of open files is cached a page at a time in frames of the
+ * frame table, so that read(), write() and file mappings all work on
+ * the same copy of it.  A page of the cache is a struct page of type
+ * VM_PAGE_CACHE, found by inode and offset in a hash table.  While it
+ * is resident, its frame holds PGSIZE bytes of the file, zeros past
+ * the end of the file.  A file mapping maps that frame itself, so a
+ * write through a mapping is seen by read() at once, and a write() by
+ * every mapping, without going to disk.
+ *
+ * The frames are reclaimed by the clock like any other.  swap_in fills
+ * a page from its file, which also serves read-ahead, and swap_out
+ * writes it back if write() or a mapping changed it.  A worker thread
+ * writes dirty pages back every WRITEBACK_INTERVAL, and the pages of a
+ * file go away when it is closed for the last time.  Metadata, that is
+ * the free map and directories, only goes through the buffer cache. */
 
+#include "filesys/page_cache.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/timer.h"
+#include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
 #include "vm/vm.h"
+
 static bool page_cache_readahead (struct page *page, void *kva);
 static bool page_cache_writeback (struct page *page);
 static void page_cache_destroy (struct page *page);
@@ -13,38 +42,384 @@ static const struct page_operations page_cache_op = {
 	.type = VM_PAGE_CACHE,
 };
 
+/* Time between two write-backs of the dirty pages. */
+#define WRITEBACK_INTERVAL (5 * TIMER_FREQ)
+
+/* Most pages written back with one write. */
+#define WRITEBACK_BATCH 16
+
+/* Pages read ahead after a sequential read(). */
+#define READAHEAD_PAGES 4
+
+static struct hash pages;             /* Pages of the cache, by inode and
+                                         offset. */
+static struct lock page_cache_lock;   /* Protects PAGES. */
+
 tid_t page_cache_workerd;
 
+/* Statistics. */
+static size_t access_cnt;       /* Pages read or written by read(),
+                                   write() and faults. */
+static size_t fill_cnt;         /* Pages read from their files. */
+static size_t ra_cnt;           /* Pages queued for read-ahead. */
+static size_t writeback_page_cnt;   /* Pages written back. */
+static size_t writeback_write_cnt;  /* Writes that wrote them. */
+
+static hash_hash_func page_cache_hash;
+static hash_less_func page_cache_less;
+static void page_cache_kworkerd (void *aux);
+
 /* The initializer of file vm */
 void
 pagecache_init (void) {
-	/* TODO: Create a worker daemon for page cache with page_cache_kworkerd */
+	hash_init (&pages, page_cache_hash, page_cache_less, NULL);
+	lock_init (&page_cache_lock);
+	page_cache_workerd = thread_create ("pagecache", PRI_DEFAULT,
+			page_cache_kworkerd, NULL);
 }
 
 /* Initialize the page cache */
 bool
-page_cache_initializer (struct page *page, enum vm_type type, void *kva) {
+page_cache_initializer (struct page *page, enum vm_type type UNUSED,
+		void *kva UNUSED) {
 	/* Set up the handler */
 	page->operations = &page_cache_op;
+	return true;
+}
+
+/* Returns a hash value for page P of the cache. */
+static uint64_t
+page_cache_hash (const struct hash_elem *p_, void *aux UNUSED) {
+	const struct page_cache *p = hash_entry (p_, struct page_cache, elem);
+
+	return hash_bytes (&p->inode, sizeof p->inode) ^ hash_int (p->ofs);
+}
+
+/* Returns true if page A of the cache precedes page B. */
+static bool
+page_cache_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page_cache *a = hash_entry (a_, struct page_cache, elem);
+	const struct page_cache *b = hash_entry (b_, struct page_cache, elem);
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	return a->ofs < b->ofs;
+}
+
+/* Returns the page of the cache for INODE at OFS, or a null pointer.
+ * Caller must hold page_cache_lock. */
+static struct page *
+page_cache_find (struct inode *inode, off_t ofs) {
+	struct page key;
+	struct hash_elem *e;
+
+	key.page_cache.inode = inode;
+	key.page_cache.ofs = ofs;
+	e = hash_find (&pages, &key.page_cache.elem);
+	return e != NULL ? hash_entry (e, struct page, page_cache.elem) : NULL;
+}
+
+/* Returns the page of the cache that holds the data of INODE at OFS,
+ * a multiple of PGSIZE.  If there is none, creates one, not resident
+ * yet, if CREATE is true, and otherwise returns a null pointer, as it
+ * does if memory is short.  The page stays valid until the last opener
+ * of INODE closes it. */
+struct page *
+page_cache_lookup (struct inode *inode, off_t ofs, bool create) {
+	struct page *page;
+
+	ASSERT (ofs % PGSIZE == 0);
+
+	lock_acquire (&page_cache_lock);
+	page = page_cache_find (inode, ofs);
+	if (page == NULL && create && (page = malloc (sizeof *page)) != NULL) {
+		*page = (struct page) {
+			.va = NULL,
+			.frame = NULL,
+			.owner = NULL,
+			.area = NULL,
+		};
+		page_cache_initializer (page, VM_PAGE_CACHE, NULL);
+		page->page_cache.inode = inode;
+		page->page_cache.ofs = ofs;
+		page->page_cache.dirty = false;
+		page->page_cache.pin_cnt = 0;
+		hash_insert (&pages, &page->page_cache.elem);
+	}
+	lock_release (&page_cache_lock);
+	return page;
+}
+
+/* Reads SIZE bytes from INODE into BUFFER, starting at OFFSET, through
+ * the page cache.  Returns the number of bytes read, which is less than
+ * SIZE at end of file or if memory is short.  If SEQUENTIAL, the read
+ * continues the previous one, and the pages after it are read ahead. */
+off_t
+page_cache_read (struct inode *inode, void *buffer_, off_t size,
+		off_t offset, bool sequential) {
+	uint8_t *buffer = buffer_;
+	off_t length = inode_length (inode);
+	off_t bytes_read = 0;
+	int i;
+
+	while (size > 0 && offset < length) {
+		off_t page_ofs = offset % PGSIZE;
+		off_t chunk = PGSIZE - page_ofs;
+		struct page *page;
+		uint8_t *kva;
+
+		if (chunk > size)
+			chunk = size;
+		if (chunk > length - offset)
+			chunk = length - offset;
+
+		page = page_cache_lookup (inode, offset - page_ofs, true);
+		if (page == NULL || (kva = vm_cache_pin (page, true)) == NULL)
+			break;
+		memcpy (buffer + bytes_read, kva + page_ofs, chunk);
+		vm_cache_unpin (page, false);
+		access_cnt++;
+
+		size -= chunk;
+		offset += chunk;
+		bytes_read += chunk;
+	}
+
+	if (sequential && bytes_read > 0)
+		for (i = 0; i < READAHEAD_PAGES; i++) {
+			off_t ofs = ROUND_UP (offset, PGSIZE) + i * PGSIZE;
+
+			if (ofs >= length || !page_cache_prefetch (inode, ofs))
+				break;
+		}
+	return bytes_read;
+}
+
+/* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET, through
+ * the page cache, which writes them back later.  The sectors they go
+ * to must be allocated already.  Returns the number of bytes written,
+ * which is less than SIZE if memory is short. */
+off_t
+page_cache_write (struct inode *inode, const void *buffer_, off_t size,
+		off_t offset) {
+	const uint8_t *buffer = buffer_;
+	off_t length = inode_length (inode);
+	off_t bytes_written = 0;
+	struct page *page;
+	uint8_t *kva;
+
+	/* A mapping of the last page may have written past the end of the
+	 * file.  What lies between the end and OFFSET must read as zeros
+	 * once the file grows. */
+	if (offset > length && length % PGSIZE != 0
+			&& (page = page_cache_lookup (inode, length - length % PGSIZE,
+					false)) != NULL
+			&& (kva = vm_cache_pin (page, true)) != NULL) {
+		off_t end = ROUND_UP (length, PGSIZE);
+
+		memset (kva + length % PGSIZE, 0,
+				(offset < end ? offset : end) - length);
+		vm_cache_unpin (page, true);
+	}
+
+	while (size > 0) {
+		off_t page_ofs = offset % PGSIZE;
+		off_t chunk = PGSIZE - page_ofs < size ? PGSIZE - page_ofs : size;
+
+		/* A page that is written whole, or lies past the end of the file,
+		 * need not be read first. */
+		bool fill = chunk < PGSIZE && offset - page_ofs < length;
 
+		page = page_cache_lookup (inode, offset - page_ofs, true);
+		if (page == NULL || (kva = vm_cache_pin (page, fill)) == NULL)
+			break;
+		memcpy (kva + page_ofs, buffer + bytes_written, chunk);
+		vm_cache_unpin (page, true);
+		access_cnt++;
+
+		size -= chunk;
+		offset += chunk;
+		bytes_written += chunk;
+	}
+	return bytes_written;
+}
+
+/* Starts reading the page of INODE at OFS into the cache, unless it is
+ * there already.  Returns false if free frames are short. */
+bool
+page_cache_prefetch (struct inode *inode, off_t ofs) {
+	struct page *page = page_cache_lookup (inode, ofs, true);
+
+	if (page == NULL || !vm_cache_prefetch (page))
+		return false;
+	ra_cnt++;
+	return true;
+}
+
+/* Writes the CNT pages in BUF to INODE from OFS on, with a single
+ * write.  Bytes past the sectors allocated to the file lie past its end
+ * and are not written. */
+static void
+write_run (struct inode *inode, off_t ofs, const void *buf, size_t cnt) {
+	writeback_page_cnt += cnt;
+	writeback_write_cnt++;
+	inode_write_disk (inode, buf, cnt * PGSIZE, ofs);
 }
 
 /* Utilze the Swap in mechanism to implement readhead */
 static bool
 page_cache_readahead (struct page *page, void *kva) {
+	struct page_cache *pc = &page->page_cache;
+	off_t bytes = inode_length (pc->inode) - pc->ofs;
+
+	if (bytes < 0)
+		bytes = 0;
+	if (bytes > PGSIZE)
+		bytes = PGSIZE;
+	if (bytes > 0 && inode_read_disk (pc->inode, kva, bytes, pc->ofs) != bytes)
+		return false;
+	memset ((uint8_t *) kva + bytes, 0, PGSIZE - bytes);
+	fill_cnt++;
+	return true;
 }
 
-/* Utilze the Swap out mechanism to implement writeback */
+/* Utilze the Swap out mechanism to implement writeback.
+ * Called by the clock with the frame lock held, once the mappings of
+ * the frame are gone and their dirty bits were collected into the
+ * page.  inode_write_disk() only goes through the buffer cache, never
+ * the page cache, so it does not take the frame lock again. */
 static bool
 page_cache_writeback (struct page *page) {
+	struct page_cache *pc = &page->page_cache;
+
+	if (pc->dirty) {
+		write_run (pc->inode, pc->ofs, page->frame->kva, 1);
+		pc->dirty = false;
+	}
+	return true;
 }
 
-/* Destory the page_cache. */
+/* Destory the page_cache.  Waits until nobody uses the frame of PAGE
+ * anymore, and frees it without writing it back.  PAGE will be freed
+ * by the caller. */
 static void
 page_cache_destroy (struct page *page) {
+	vm_cache_release (page);
 }
 
-/* Worker thread for page cache */
+/* Writes the dirty pages of INODE between offsets START and END back,
+ * in file order, each run of adjacent dirty pages with one write of up
+ * to WRITEBACK_BATCH pages gathered in a bounce buffer.  Returns false
+ * if no bounce buffer could be allocated. */
+bool
+page_cache_sync (struct inode *inode, off_t start, off_t end) {
+	size_t batch = WRITEBACK_BATCH, cnt = 0;
+	off_t run = 0, ofs;
+	uint8_t *buf;
+
+	buf = palloc_get_multiple (0, batch);
+	if (buf == NULL) {
+		batch = 1;
+		if ((buf = palloc_get_page (0)) == NULL)
+			return false;
+	}
+
+	for (ofs = start - start % PGSIZE; ofs < end; ofs += PGSIZE) {
+		struct page *page = page_cache_lookup (inode, ofs, false);
+		void *kva;
+
+		if (page == NULL || (kva = vm_cache_pin_dirty (page)) == NULL)
+			continue;
+		if (cnt > 0 && (cnt == batch || ofs != run + (off_t) (cnt * PGSIZE))) {
+			write_run (inode, run, buf, cnt);
+			cnt = 0;
+		}
+		if (cnt == 0)
+			run = ofs;
+		memcpy (buf + cnt++ * PGSIZE, kva, PGSIZE);
+		vm_cache_unpin (page, false);
+	}
+	if (cnt > 0)
+		write_run (inode, run, buf, cnt);
+
+	palloc_free_multiple (buf, batch);
+	return true;
+}
+
+/* Removes the pages of INODE, whose data lies in its first SIZE bytes,
+ * from the cache, once its last opener closes it.  They are written
+ * back first if WRITE_BACK is true; the pages of a removed file are
+ * simply dropped. */
+void
+page_cache_drop (struct inode *inode, off_t size, bool write_back) {
+	off_t ofs;
+
+	if (write_back)
+		page_cache_sync (inode, 0, size);
+
+	for (ofs = 0; ofs < size; ofs += PGSIZE) {
+		struct page *page;
+
+		lock_acquire (&page_cache_lock);
+		page = page_cache_find (inode, ofs);
+		if (page != NULL)
+			hash_delete (&pages, &page->page_cache.elem);
+		lock_release (&page_cache_lock);
+
+		if (page != NULL)
+			vm_dealloc_page (page);
+	}
+}
+
+/* Writes every dirty page of the cache back to its file, WRITEBACK_BATCH
+ * pages at a time.  A page being written back stays pinned, so that the
+ * last close of its file waits for it. */
+void
+page_cache_flush (void) {
+	struct page *batch[WRITEBACK_BATCH];
+	void *kvas[WRITEBACK_BATCH];
+	size_t cnt, i;
+
+	do {
+		struct hash_iterator it;
+
+		cnt = 0;
+		lock_acquire (&page_cache_lock);
+		hash_first (&it, &pages);
+		while (cnt < WRITEBACK_BATCH && hash_next (&it)) {
+			struct page *page = hash_entry (hash_cur (&it), struct page,
+					page_cache.elem);
+
+			if ((kvas[cnt] = vm_cache_pin_dirty (page)) != NULL)
+				batch[cnt++] = page;
+		}
+		lock_release (&page_cache_lock);
+
+		for (i = 0; i < cnt; i++) {
+			struct page_cache *pc = &batch[i]->page_cache;
+
+			write_run (pc->inode, pc->ofs, kvas[i], 1);
+			vm_cache_unpin (batch[i], false);
+		}
+	} while (cnt == WRITEBACK_BATCH);
+}
+
+/* Worker thread for page cache.  Writes the dirty pages back every
+ * WRITEBACK_INTERVAL. */
 static void
-page_cache_kworkerd (void *aux) {
+page_cache_kworkerd (void *aux UNUSED) {
+	for (;;) {
+		timer_sleep (WRITEBACK_INTERVAL);
+		page_cache_flush ();
+	}
+}
+
+/* Prints page cache statistics. */
+void
+page_cache_print_stats (void) {
+	printf ("Page cache: %zu page accesses, %zu pages read, "
+			"%zu read ahead\n", access_cnt, fill_cnt, ra_cnt);
+	printf ("Page cache: %zu pages written back in %zu writes\n",
+			writeback_page_cnt, writeback_write_cnt);
 }
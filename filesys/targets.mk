@@ -4,5 +4,5 @@ filesys_SRC += filesys/free-map.c	# Free sector bitmap.
 filesys_SRC += filesys/file.c		# Files.
 filesys_SRC += filesys/directory.c	# Directories.
 filesys_SRC += filesys/inode.c		# File headers.
+filesys_SRC += filesys/cache.c		# Buffer cache.
 filesys_SRC += filesys/fsutil.c		# Utilities.
-filesys_SRC += filesys/page_cache.c		# Page cache.
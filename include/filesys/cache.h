@@ -0,0 +1,16 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stddef.h>
+#include "devices/disk.h"
+
+void cache_init (void);
+void cache_read (disk_sector_t, void *, int ofs, int size);
+void cache_write (disk_sector_t, const void *, int ofs, int size);
+void cache_read_run (disk_sector_t, void *, size_t cnt);
+void cache_write_run (disk_sector_t, const void *, size_t cnt);
+void cache_readahead (disk_sector_t);
+void cache_flush (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -1,12 +1,36 @@
 #ifndef FILESYS_PAGE_CACHE_H
 #define FILESYS_PAGE_CACHE_H
-#include "vm/vm.h"
+#include <hash.h>
+#include <stdbool.h>
+#include "filesys/off_t.h"
 
 struct page;
+struct inode;
 enum vm_type;
 
-struct page_cache {};
+/* A page of the page cache: PGSIZE bytes of INODE from OFS on. */
+struct page_cache {
+	struct inode *inode;     /* File the page belongs to. */
+	off_t ofs;               /* Offset in INODE, a multiple of PGSIZE. */
+	bool dirty;              /* Written by write() since it was last
+	                            written back; see also the dirty bits
+	                            of its mappings.  Protected by the
+	                            frame lock. */
+	unsigned pin_cnt;        /* Threads copying data in or out of the
+	                            frame.  Protected by the frame lock. */
+	struct hash_elem elem;   /* In the page cache index. */
+};
 
-void page_cache_init (void);
+void pagecache_init (void);
 bool page_cache_initializer (struct page *page, enum vm_type type, void *kva);
+struct page *page_cache_lookup (struct inode *, off_t ofs, bool create);
+off_t page_cache_read (struct inode *, void *, off_t size, off_t offset,
+		bool sequential);
+off_t page_cache_write (struct inode *, const void *, off_t size,
+		off_t offset);
+bool page_cache_prefetch (struct inode *, off_t ofs);
+bool page_cache_sync (struct inode *, off_t start, off_t end);
+void page_cache_drop (struct inode *, off_t size, bool write_back);
+void page_cache_flush (void);
+void page_cache_print_stats (void);
 #endif
@@ -36,6 +36,13 @@ enum {
 
 	SYS_MOUNT,
 	SYS_UMOUNT,
+
+	/* Extra for Project 3 */
+	SYS_MSYNC,                  /* Write back a memory mapping. */
+	SYS_MADVISE,                /* Advise on the use of a memory range. */
+	SYS_VMSTAT,                 /* Report the memory use of this process. */
+	SYS_MEMCG_CREATE,           /* Move into a new memory control group. */
+	SYS_MEMCG_STAT,             /* Report the memory use of the group. */
 };
 
 #endif /* lib/syscall-nr.h */
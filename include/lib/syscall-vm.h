@@ -0,0 +1,44 @@
+#ifndef __LIB_SYSCALL_VM_H
+#define __LIB_SYSCALL_VM_H
+
+/* Flags and structures of the memory system calls, shared by the
+ * kernel and user programs. */
+
+/* Flags for msync().  Write-back is always synchronous. */
+#define MS_ASYNC 1              /* Schedule the write-back. */
+#define MS_SYNC 4               /* Write back before returning. */
+
+/* Advice for madvise(). */
+#define MADV_NORMAL 0           /* No special treatment. */
+#define MADV_RANDOM 1           /* Expect random access: no readahead. */
+#define MADV_SEQUENTIAL 2       /* Expect sequential access. */
+#define MADV_WILLNEED 3         /* Start reading the range now. */
+#define MADV_DONTNEED 4         /* Release the range's memory now. */
+
+/* Memory use of a process, as reported by vmstat().  Sizes are in
+ * pages.  The working set is the set of pages touched within the last
+ * 1, 4 and 8 sampling intervals. */
+struct vmstat {
+	unsigned long major_faults;   /* Faults that waited for a disk read. */
+	unsigned long minor_faults;   /* Faults served from memory. */
+	unsigned long stack_faults;   /* Faults that grew the stack. */
+	unsigned long cow_faults;     /* Writes to a copy-on-write page. */
+	unsigned long swap_ins;       /* Pages brought back from swap. */
+	unsigned long resident;       /* Pages with a frame. */
+	unsigned long wss[3];         /* Working set over 1, 4, 8 intervals. */
+};
+
+/* Returned by memcg_stat().  Sizes are in pages, and a limit of 0
+ * means none. */
+struct memcg_stat {
+	int id;                       /* Group number, 0 for the root group. */
+	unsigned long usage;          /* Frames charged to the group. */
+	unsigned long max_usage;      /* Highest usage so far. */
+	unsigned long soft_limit;     /* Reclaimed from first above this. */
+	unsigned long hard_limit;     /* Never charged beyond this. */
+	unsigned long reclaims;       /* Frames reclaimed at the hard limit. */
+	unsigned long soft_reclaims;  /* Frames reclaimed above the soft limit. */
+	unsigned long failures;       /* Frames refused at the hard limit. */
+};
+
+#endif /* lib/syscall-vm.h */
@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <debug.h>
 #include <stddef.h>
+#include "../syscall-vm.h"
 
 /* Process identifier. */
 typedef int pid_t;
@@ -41,6 +42,11 @@ int dup2(int oldfd, int newfd);
 /* Project 3 and optionally project 4. */
 void *mmap (void *addr, size_t length, int writable, int fd, off_t offset);
 void munmap (void *addr);
+int msync (void *addr, size_t length, int flags);
+int madvise (void *addr, size_t length, int advice);
+int vmstat (struct vmstat *stat);
+int memcg_create (size_t soft_limit, size_t hard_limit);
+int memcg_stat (struct memcg_stat *stat);
 
 /* Project 4 only. */
 bool chdir (const char *dir);
@@ -2,23 +2,51 @@
 #define THREAD_MMU_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include "threads/pte.h"
 
 typedef bool pte_for_each_func (uint64_t *pte, void *va, void *aux);
+typedef bool pte_run_func (uint64_t *pte, size_t cnt, void *va, void *aux);
 
 uint64_t *pml4e_walk (uint64_t *pml4, const uint64_t va, int create);
+uint64_t *pml4e_walk_large (uint64_t *pml4, const uint64_t va, uint64_t size,
+		int create);
 uint64_t *pml4_create (void);
 bool pml4_for_each (uint64_t *, pte_for_each_func *, void *);
+bool pml4_for_each_run (uint64_t *pml4, void *start, void *end,
+		pte_run_func *func, void *aux);
+bool pml4_copy_range (uint64_t *dst, uint64_t *src, void *start, void *end);
 void pml4_destroy (uint64_t *pml4);
 void pml4_activate (uint64_t *pml4);
 void *pml4_get_page (uint64_t *pml4, const void *upage);
 bool pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw);
+bool pml4_split_large_page (uint64_t *pml4, void *upage);
 void pml4_clear_page (uint64_t *pml4, void *upage);
 bool pml4_is_dirty (uint64_t *pml4, const void *upage);
 void pml4_set_dirty (uint64_t *pml4, const void *upage, bool dirty);
 bool pml4_is_accessed (uint64_t *pml4, const void *upage);
 void pml4_set_accessed (uint64_t *pml4, const void *upage, bool accessed);
+void pml4_set_writable (uint64_t *pml4, const void *upage, bool writable);
+
+/* A batch of TLB invalidations for the active page map.  While a batch
+ * is open in the current thread, changed pages of its page map are not
+ * invalidated one by one: tlb_batch_end() invalidates the range they
+ * span at once, page by page if it is small and by flushing the whole
+ * TLB of the address space otherwise.  Batches nest.  The pages must
+ * not be touched through the page map before the batch ends. */
+struct tlb_batch {
+	uint64_t *pml4;       /* Page map the batch is for. */
+	uint64_t start;       /* First page to invalidate. */
+	uint64_t end;         /* One past the last page, or START if none. */
+	bool outer;           /* Whether this batch opened the thread's. */
+};
+
+void tlb_batch_begin (struct tlb_batch *);
+void tlb_batch_end (struct tlb_batch *);
+void pcid_init (void);
+void tlb_print_stats (void);
 
 #define is_writable(pte) (*(pte) & PTE_W)
 #define is_user_pte(pte) (*(pte) & PTE_U)
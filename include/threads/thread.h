@@ -129,12 +129,20 @@ struct thread {
 #ifdef USERPROG
 	/* Owned by userprog/process.c. */
 	uint64_t *pml4;                     /* Page map level 4 */
+	struct tlb_batch *tlb_batch;        /* Open TLB batch, or NULL. */
 #endif
 #ifdef VM
 	/* Table for whole virtual memory owned by thread. */
 	struct supplemental_page_table spt;
 	void* stack_page_end;
 	void* current_rsp;
+	struct vmstat vmstat;               /* Fault counters of the process. */
+	int64_t ws_sampled;                 /* Tick of the last working set
+	                                       sample. */
+	bool fault_io;                      /* The fault being handled waited
+	                                       for the disk. */
+	struct memcg *memcg;                /* Memory control group, or NULL
+	                                       for the root group. */
 #endif
 
 	/* Owned by thread.c. */
@@ -9,12 +9,7 @@ int process_exec (void *f_name);
 int process_wait (tid_t);
 void process_exit (void);
 void process_activate (struct thread *next);
-
-struct args_for_lazy_load_segment {
-	struct file *file;
-	size_t page_read_bytes;
-	off_t ofs;
-};
+void process_print_stats (void);
 
 #endif /* userprog/process.h */
 
@@ -1,13 +1,26 @@
 #ifndef VM_ANON_H
 #define VM_ANON_H
+#include <stddef.h>
 #include "vm/vm.h"
 struct page;
 enum vm_type;
 
+/* Marks an anonymous page that has no swap slot. */
+#define SWAP_SLOT_NONE ((size_t) -1)
+
+/* Most pages written to swap, or read back, with one disk command. */
+#define SWAP_CLUSTER_MAX 8
+
 struct anon_page {
+	size_t slot;             /* Swap slot holding the page, or SWAP_SLOT_NONE. */
 };
 
 void vm_anon_init (void);
 bool anon_initializer (struct page *page, enum vm_type type, void *kva);
+void anon_init_zero (struct page *page);
+bool anon_swap_out_cluster (struct page *pages[], size_t cnt);
+void anon_swap_write_slot (size_t slot, const void *kva);
+void anon_share (struct page *dst, struct page *src);
+void anon_print_stats (void);
 
 #endif
@@ -0,0 +1,59 @@
+#ifndef VM_AREA_H
+#define VM_AREA_H
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "filesys/off_t.h"
+#include "vm/vm.h"
+
+struct page;
+struct file;
+struct supplemental_page_table;
+enum vm_type;
+
+/* A virtual memory area: a page-aligned range of user memory with
+ * uniform backing and permission.  ELF segments and mmaps are recorded
+ * as areas, and the pages inside an area get their struct page only
+ * when they are faulted in for the first time. */
+struct vm_area {
+	void *start;             /* First page of the area. */
+	void *end;               /* One past the last page of the area. */
+	enum vm_type type;       /* VM_ANON or VM_FILE, type of its pages. */
+	bool writable;           /* Pages may be written by the user. */
+	struct file *file;       /* Backing file owned by the area, or NULL. */
+	off_t ofs;               /* File offset that START maps. */
+	size_t read_bytes;       /* Bytes read from FILE, the rest is zero. */
+	struct list pages;       /* Pages faulted in so far (page.area_elem). */
+	struct list_elem elem;   /* In spt->areas, sorted by START. */
+
+	/* Sequential readahead of the file part of the area. */
+	void *ra_prev;           /* Page of the last fault. */
+	void *ra_start;          /* First page of the last window. */
+	void *ra_next;           /* First page after the last window. */
+	size_t ra_pages;         /* Size of the last window, in pages. */
+	int advice;              /* Access pattern given by madvise(), a
+	                            MADV_* other than the one-shot ones. */
+};
+
+/* Readahead window sizes, in pages.  The window starts small when
+ * faults turn out to be sequential and doubles on every hit. */
+#define RA_MIN_PAGES 4
+#define RA_MAX_PAGES 32
+
+struct vm_area *vm_area_create (struct supplemental_page_table *spt,
+		void *start, size_t length, enum vm_type type, bool writable,
+		struct file *file, off_t ofs, size_t read_bytes);
+void vm_area_destroy (struct supplemental_page_table *spt,
+		struct vm_area *area);
+struct vm_area *vm_area_find (struct supplemental_page_table *spt,
+		const void *va);
+bool vm_area_overlaps (struct supplemental_page_table *spt,
+		const void *start, size_t length);
+struct page *vm_area_alloc_page (struct vm_area *area, void *va, bool load);
+size_t vm_area_page_read_bytes (const struct vm_area *area, const void *va);
+off_t vm_area_page_offset (const struct vm_area *area, const void *va);
+bool vm_area_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src);
+void vm_area_kill (struct supplemental_page_table *spt);
+
+#endif
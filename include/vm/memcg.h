@@ -0,0 +1,40 @@
+#ifndef VM_MEMCG_H
+#define VM_MEMCG_H
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+struct thread;
+struct memcg_stat;
+
+/* A memory control group: processes whose frames are counted, and
+ * limited, together.  Sizes are in pages; a limit of 0 means none. */
+struct memcg {
+	int id;                     /* Group number, 0 for the root group. */
+	size_t usage;               /* Frames charged to the group. */
+	size_t max_usage;           /* Highest USAGE so far. */
+	size_t soft_limit;          /* Reclaimed from first above this. */
+	size_t hard_limit;          /* Never charged beyond this. */
+	size_t refs;                /* Processes in the group. */
+	size_t reclaim_cnt;         /* Frames reclaimed at the hard limit. */
+	size_t soft_reclaim_cnt;    /* Frames reclaimed above the soft limit. */
+	size_t fail_cnt;            /* Frames refused at the hard limit. */
+	struct list_elem elem;      /* In the list of groups. */
+};
+
+void memcg_init (void);
+struct memcg *memcg_of (struct thread *t);
+int memcg_enter_new (size_t soft_limit, size_t hard_limit);
+void memcg_attach (struct thread *t, struct memcg *cg);
+void memcg_detach (struct thread *t);
+bool memcg_at_limit (struct memcg *cg, size_t pages);
+bool memcg_over_soft (struct memcg *cg);
+bool memcg_any_over_soft (void);
+void memcg_charge (struct memcg *cg, size_t pages);
+void memcg_uncharge (struct memcg *cg, size_t pages);
+void memcg_count_reclaim (struct memcg *cg, bool soft);
+void memcg_count_fail (struct memcg *cg);
+void memcg_get_stat (struct memcg *cg, struct memcg_stat *stat);
+void memcg_print_stats (void);
+
+#endif
@@ -2,7 +2,10 @@
 #define VM_VM_H
 #include <stdbool.h>
 #include <list.h>
+#include <hash.h>
+#include <syscall-vm.h>
 #include "threads/palloc.h"
+#include "threads/pte.h"
 
 enum vm_type {
 	/* page not initialized */
@@ -28,12 +31,12 @@ enum vm_type {
 #include "vm/uninit.h"
 #include "vm/anon.h"
 #include "vm/file.h"
-#ifdef EFILESYS
+#include "vm/area.h"
 #include "filesys/page_cache.h"
-#endif
 
 struct page_operations;
 struct thread;
+struct inode;
 
 #define VM_TYPE(type) ((type) & 7)
 
@@ -49,7 +52,13 @@ struct page {
 	/* Your implementation */
 	
 	bool is_writable;
-	struct list_elem spt_elem;
+	struct hash_elem spt_elem;
+	struct thread *owner;  /* Process whose address space holds the page. */
+	struct vm_area *area;  /* Area the page was faulted in from, or NULL. */
+	struct list_elem area_elem;
+	struct list_elem frame_elem;  /* In frame->pages while mapped. */
+	uint8_t ws_hist;       /* Accessed bit at the last working set
+	                          samples, the latest in bit 0. */
 
 	/* Per-type data are binded into the union.
 	 * Each function automatically detects the current union */
@@ -57,19 +66,46 @@ struct page {
 		struct uninit_page uninit;
 		struct anon_page anon;
 		struct file_page file;
-#ifdef EFILESYS
 		struct page_cache page_cache;
-#endif
 	};
 };
 
+/* What a frame of the text cache holds: READ_BYTES bytes of INODE at
+ * offset OFS, followed by zeros. */
+struct text_key {
+	struct inode *inode;
+	off_t ofs;
+	size_t read_bytes;
+};
+
 /* The representation of "frame" */
 struct frame {
 	void *kva;
-	struct page *page;
+	struct page *page;         /* Page whose contents the frame holds.
+	                              In the page cache, that is its
+	                              VM_PAGE_CACHE page, not on PAGES. */
+	struct list pages;         /* Every page mapping the frame. */
 	struct list_elem frt_elem;
+	bool pinned;               /* Being filled, must not be evicted. */
+	bool io_pending;           /* Being filled by the readahead thread,
+	                              or written out by kswapd. */
+	bool referenced;           /* Accessed bit taken by the working set
+	                              sampler, not yet seen by the clock. */
+	struct list_elem io_elem;  /* In the readahead queue. */
+	/* Number of pages still backed by this frame when it is a 2 MiB
+	 * huge frame (PAGE is then the first page of the region), 0 for an
+	 * ordinary 4 kB frame. */
+	size_t huge_refs;
+	bool text_cached;          /* In the text cache, under TEXT. */
+	struct text_key text;
+	struct hash_elem text_elem;
+	struct memcg *memcg;       /* Group the frame is charged to. */
+	size_t charged;            /* Pages charged to MEMCG, 0 if none. */
 };
 
+/* Number of 4 kB pages backed by a huge frame. */
+#define HUGE_PAGE_CNT (LARGE_PGSIZE / PGSIZE)
+
 /* The function table for page operations.
  * This is one way of implementing "interface" in C.
  * Put the table of "method" into the struct's member, and
@@ -90,7 +126,9 @@ struct page_operations {
  * We don't want to force you to obey any specific design for this struct.
  * All designs up to you for this. */
 struct supplemental_page_table {
-	struct list sptable_list;
+	struct hash sptable_hash;  /* Pages keyed by their user virtual address. */
+	struct list areas;         /* struct vm_area, sorted by start address. */
+	struct vm_area *area_cache;  /* Area found by the last lookup. */
 };
 
 #include "threads/thread.h"
@@ -103,6 +141,18 @@ struct page *spt_find_page (struct supplemental_page_table *spt,
 bool spt_insert_page (struct supplemental_page_table *spt, struct page *page);
 void spt_remove_page (struct supplemental_page_table *spt, struct page *page);
 
+extern size_t vm_wmark_min, vm_wmark_low, vm_wmark_high;
+
+/* The user stack grows down to at most STACK_MAX bytes below
+ * USER_STACK, and no mapping may come within STACK_GUARD_GAP bytes of
+ * that limit. */
+#define STACK_MAX (1024 * 1024)
+#define STACK_GUARD_GAP (256 * 1024)
+#define STACK_LIMIT ((uint8_t *) USER_STACK - STACK_MAX)
+
+extern size_t vm_stack_chunk;
+extern bool vm_exit_stats;
+
 void vm_init (void);
 bool vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
 		bool write, bool not_present);
@@ -113,6 +163,20 @@ bool vm_alloc_page_with_initializer (enum vm_type type, void *upage,
 		bool writable, vm_initializer *init, void *aux);
 void vm_dealloc_page (struct page *page);
 bool vm_claim_page (void *va);
+bool vm_split_huge_frame (struct frame *frame);
+void *vm_frame_detach (struct page *page);
+void *vm_frame_prefetch (struct page *page);
+void vm_frame_unpin (struct page *page);
+void *vm_cache_pin (struct page *page, bool fill);
+void *vm_cache_pin_dirty (struct page *page);
+void vm_cache_unpin (struct page *page, bool dirty);
+bool vm_cache_prefetch (struct page *page);
+void vm_cache_release (struct page *page);
+void vm_area_willneed (struct vm_area *area, void *start, void *end);
 enum vm_type page_get_type (struct page *page);
+void vm_print_stats (void);
+void vm_ws_sample (void);
+void vm_stat (struct vmstat *stat);
+void vm_print_exit_stats (void);
 
 #endif  /* VM_VM_H */
@@ -0,0 +1,14 @@
+#ifndef VM_ZSWAP_H
+#define VM_ZSWAP_H
+#include <stdbool.h>
+#include <stddef.h>
+
+void zswap_init (size_t max_bytes);
+bool zswap_store (size_t slot, const void *kva);
+void zswap_shrink (void);
+bool zswap_load (size_t slot, void *kva);
+bool zswap_contains (size_t slot);
+void zswap_invalidate (size_t slot);
+void zswap_print_stats (void);
+
+#endif
@@ -326,6 +326,24 @@ bitmap_write (const struct bitmap *b, struct file *file) {
 	off_t size = byte_cnt (b->bit_cnt);
 	return file_write_at (file, b->bits, size, 0) == size;
 }
+
+/* Writes the SIZE bytes of B from byte offset OFS on to the same
+   place in FILE, as part of what bitmap_write() would write.
+   Bytes past the end of B are not written.  Return true if
+   successful, false otherwise. */
+bool
+bitmap_write_part (const struct bitmap *b, struct file *file,
+		off_t ofs, off_t size) {
+	off_t file_size = byte_cnt (b->bit_cnt);
+
+	ASSERT (ofs >= 0 && size >= 0);
+	if (ofs >= file_size)
+		return true;
+	if (size > file_size - ofs)
+		size = file_size - ofs;
+	return file_write_at (file, (const uint8_t *) b->bits + ofs, size, ofs)
+		== size;
+}
 #endif /* FILESYS */
 
 /* Debugging. */
@@ -155,6 +155,31 @@ munmap (void *addr) {
 	syscall1 (SYS_MUNMAP, addr);
 }
 
+int
+msync (void *addr, size_t length, int flags) {
+	return syscall3 (SYS_MSYNC, addr, length, flags);
+}
+
+int
+madvise (void *addr, size_t length, int advice) {
+	return syscall3 (SYS_MADVISE, addr, length, advice);
+}
+
+int
+vmstat (struct vmstat *stat) {
+	return syscall1 (SYS_VMSTAT, stat);
+}
+
+int
+memcg_create (size_t soft_limit, size_t hard_limit) {
+	return syscall2 (SYS_MEMCG_CREATE, soft_limit, hard_limit);
+}
+
+int
+memcg_stat (struct memcg_stat *stat) {
+	return syscall1 (SYS_MEMCG_STAT, stat);
+}
+
 bool
 chdir (const char *dir) {
 	return syscall1 (SYS_CHDIR, dir);
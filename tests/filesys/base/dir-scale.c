@@ -0,0 +1,73 @@
+/* Creates FILE_CNT files in the root directory, opens each of them
+   by name, removes every other one, and checks that exactly those
+   are gone.  Serves as a benchmark for lookups in a large directory:
+   the disk and buffer cache statistics printed at shutdown show how
+   many sectors they read. */
+
+#include <stdio.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_CNT 300
+
+/* Sets NAME to the name of file I. */
+static void
+file_name (char name[16], int i)
+{
+  snprintf (name, 16, "file%d", i);
+}
+
+void
+test_main (void)
+{
+  char name[16];
+  int i, fd;
+
+  msg ("creating %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_name (name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+
+  msg ("opening %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_name (name, i);
+      if ((fd = open (name)) < 2)
+        fail ("open \"%s\" failed", name);
+      close (fd);
+    }
+
+  msg ("removing every other file");
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      file_name (name, i);
+      if (!remove (name))
+        fail ("remove \"%s\" failed", name);
+    }
+
+  msg ("checking %d files", FILE_CNT);
+  for (i = 0; i < FILE_CNT; i++)
+    {
+      file_name (name, i);
+      fd = open (name);
+      if (i % 2 == 0 && fd >= 0)
+        fail ("removed \"%s\" could be opened", name);
+      if (i % 2 != 0 && fd < 2)
+        fail ("open \"%s\" failed", name);
+      if (fd >= 2)
+        close (fd);
+    }
+
+  msg ("creating the removed files again");
+  for (i = 0; i < FILE_CNT; i += 2)
+    {
+      file_name (name, i);
+      if (!create (name, 0))
+        fail ("create \"%s\" failed", name);
+    }
+  CHECK (!create ("file1", 0), "create existing \"file1\" fails");
+}
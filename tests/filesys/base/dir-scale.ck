@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(dir-scale) begin
+(dir-scale) creating 300 files
+(dir-scale) opening 300 files
+(dir-scale) removing every other file
+(dir-scale) checking 300 files
+(dir-scale) creating the removed files again
+(dir-scale) create existing "file1" fails
+(dir-scale) end
+EOF
+pass;
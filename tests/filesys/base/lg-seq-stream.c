@@ -0,0 +1,51 @@
+/* Grows a file from empty by sequential 4 kB writes, then reads it
+   back sequentially in 32 kB blocks and verifies it.  Serves as a
+   throughput benchmark for large sequential transfers: the disk
+   statistics printed at shutdown show how many commands they took. */
+
+#include <random.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define FILE_SIZE (256 * 1024)
+#define WRITE_SIZE 4096
+#define READ_SIZE (32 * 1024)
+
+static char buf[FILE_SIZE];
+static char block[READ_SIZE];
+
+void
+test_main (void) 
+{
+  const char *file_name = "stream";
+  size_t ofs;
+  int fd;
+
+  random_init (0);
+  random_bytes (buf, sizeof buf);
+
+  CHECK (create (file_name, 0), "create \"%s\"", file_name);
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\"", file_name);
+  msg ("writing \"%s\"", file_name);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += WRITE_SIZE)
+    if (write (fd, buf + ofs, WRITE_SIZE) != WRITE_SIZE)
+      fail ("write %d bytes at offset %zu in \"%s\" failed",
+            WRITE_SIZE, ofs, file_name);
+  msg ("close \"%s\"", file_name);
+  close (fd);
+
+  CHECK ((fd = open (file_name)) > 1, "open \"%s\" for reading", file_name);
+  CHECK (filesize (fd) == FILE_SIZE, "size of \"%s\" is %d",
+         file_name, FILE_SIZE);
+  msg ("reading \"%s\"", file_name);
+  for (ofs = 0; ofs < FILE_SIZE; ofs += READ_SIZE)
+    {
+      if (read (fd, block, READ_SIZE) != READ_SIZE)
+        fail ("read %d bytes at offset %zu in \"%s\" failed",
+              READ_SIZE, ofs, file_name);
+      compare_bytes (block, buf + ofs, READ_SIZE, ofs, file_name);
+    }
+  msg ("close \"%s\"", file_name);
+  close (fd);
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(lg-seq-stream) begin
+(lg-seq-stream) create "stream"
+(lg-seq-stream) open "stream"
+(lg-seq-stream) writing "stream"
+(lg-seq-stream) close "stream"
+(lg-seq-stream) open "stream" for reading
+(lg-seq-stream) size of "stream" is 262144
+(lg-seq-stream) reading "stream"
+(lg-seq-stream) close "stream"
+(lg-seq-stream) end
+EOF
+pass;
@@ -0,0 +1,46 @@
+/* Forks several children, one after another, from a process with a
+   large resident data region.  Each child checks the data it
+   inherited and overwrites one page of it, which must not change the
+   parent's copy.  With copy-on-write, fork only shares the region, so
+   this also serves as a fork latency benchmark: see the fork line of
+   the VM statistics printed at shutdown. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+#define CHILD_CNT 8
+
+static char buf[PAGE_CNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  int i, c;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (buf + i * PAGE_SIZE, i, PAGE_SIZE);
+
+  for (c = 0; c < CHILD_CNT; c++)
+    {
+      pid_t child = fork ("child");
+      if (child == 0)
+        {
+          for (i = 0; i < PAGE_CNT; i++)
+            if (buf[i * PAGE_SIZE] != i
+                || buf[i * PAGE_SIZE + PAGE_SIZE - 1] != i)
+              fail ("child %d: page %d has wrong data", c, i);
+          memset (buf + c * PAGE_SIZE, 0xff, PAGE_SIZE);
+          exit (c);
+        }
+      CHECK (wait (child) == c, "wait for child %d", c);
+    }
+
+  for (i = 0; i < PAGE_CNT; i++)
+    if (buf[i * PAGE_SIZE] != i || buf[i * PAGE_SIZE + PAGE_SIZE - 1] != i)
+      fail ("parent: page %d has wrong data", i);
+  msg ("parent's data unchanged");
+}
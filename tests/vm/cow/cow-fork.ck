@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(cow-fork) begin
+(cow-fork) wait for child 0
+(cow-fork) wait for child 1
+(cow-fork) wait for child 2
+(cow-fork) wait for child 3
+(cow-fork) wait for child 4
+(cow-fork) wait for child 5
+(cow-fork) wait for child 6
+(cow-fork) wait for child 7
+(cow-fork) parent's data unchanged
+(cow-fork) end
+EOF
+pass;
@@ -0,0 +1,52 @@
+/* Maps a file at 64 places 32 MiB apart and touches each mapping, so
+   that the address space is large but sparse, then forks children
+   that touch every mapping again and exit.  Serves as a benchmark of
+   copying and tearing down sparse page tables: see the address space
+   line of the statistics printed at shutdown. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define MAP_CNT 64
+#define CHILD_CNT 8
+#define BASE ((char *) 0x50000000)
+#define STRIDE (32 * 1024 * 1024)
+
+/* Returns true if every mapping holds the sample. */
+static bool
+check_maps (void)
+{
+  int i;
+
+  for (i = 0; i < MAP_CNT; i++)
+    if (memcmp (BASE + i * STRIDE, sample, strlen (sample)))
+      return false;
+  return true;
+}
+
+void
+test_main (void)
+{
+  int handle, i;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  for (i = 0; i < MAP_CNT; i++)
+    if (mmap (BASE + i * STRIDE, 4096, 0, handle, 0) == MAP_FAILED)
+      fail ("mmap #%d failed", i);
+  msg ("mmap \"sample.txt\" %d times", MAP_CNT);
+  CHECK (check_maps (), "check mappings");
+
+  for (i = 0; i < CHILD_CNT; i++)
+    {
+      int pid = fork ("child");
+
+      if (pid == 0)
+        exit (check_maps () ? 0 : 1);
+      if (pid < 0 || wait (pid) != 0)
+        fail ("child %d failed", i);
+    }
+  msg ("forked %d children", CHILD_CNT);
+}
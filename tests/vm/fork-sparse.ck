@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(fork-sparse) begin
+(fork-sparse) open "sample.txt"
+(fork-sparse) mmap "sample.txt" 64 times
+(fork-sparse) check mappings
+(fork-sparse) forked 8 children
+(fork-sparse) end
+EOF
+pass;
@@ -0,0 +1,62 @@
+/* Moves the process into a memory control group with a hard limit
+   well below the memory it then touches, and checks that the group
+   never goes over the limit, that it reclaims its own pages to stay
+   under it, and that the data survives.  A forked child stays in the
+   group. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 256
+#define SOFT_LIMIT 32
+#define HARD_LIMIT 64
+
+static char buf[PAGE_COUNT * PAGE_SIZE];
+
+void
+test_main (void)
+{
+  struct memcg_stat st;
+  size_t i;
+  int id, pid;
+
+  CHECK (memcg_create (HARD_LIMIT + 1, HARD_LIMIT) == -1,
+         "soft limit above hard limit is refused");
+  CHECK (memcg_stat (&st) == 0 && st.id == 0, "still in the root group");
+
+  id = memcg_create (SOFT_LIMIT, HARD_LIMIT);
+  CHECK (id > 0, "create group");
+  CHECK (memcg_stat (&st) == 0 && st.id == id, "moved into the group");
+  if (st.soft_limit != SOFT_LIMIT || st.hard_limit != HARD_LIMIT)
+    fail ("limits %lu/%lu, expected %d/%d",
+          st.soft_limit, st.hard_limit, SOFT_LIMIT, HARD_LIMIT);
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    memset (buf + i * PAGE_SIZE, i, PAGE_SIZE);
+  CHECK (memcg_stat (&st) == 0, "touch %d pages", PAGE_COUNT);
+  if (st.usage > HARD_LIMIT || st.max_usage > HARD_LIMIT)
+    fail ("group uses %lu pages, at most %lu, over the limit of %d",
+          st.usage, st.max_usage, HARD_LIMIT);
+  if (st.reclaims == 0)
+    fail ("group did not reclaim its own pages");
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    if (buf[i * PAGE_SIZE] != (char) i
+        || buf[i * PAGE_SIZE + PAGE_SIZE - 1] != (char) i)
+      fail ("page %zu corrupted", i);
+  CHECK (memcg_stat (&st) == 0, "read back %d pages", PAGE_COUNT);
+  if (st.max_usage > HARD_LIMIT)
+    fail ("group used %lu pages, over the limit of %d",
+          st.max_usage, HARD_LIMIT);
+
+  pid = fork ("child");
+  if (pid == 0)
+    {
+      CHECK (memcg_stat (&st) == 0 && st.id == id, "child is in the group");
+      exit (0);
+    }
+  CHECK (wait (pid) == 0, "wait for child");
+}
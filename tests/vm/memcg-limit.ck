@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(memcg-limit) begin
+(memcg-limit) soft limit above hard limit is refused
+(memcg-limit) still in the root group
+(memcg-limit) create group
+(memcg-limit) moved into the group
+(memcg-limit) touch 256 pages
+(memcg-limit) read back 256 pages
+(memcg-limit) child is in the group
+(memcg-limit) wait for child
+(memcg-limit) end
+EOF
+pass;
@@ -0,0 +1,47 @@
+/* Writes to a file through a mapping and checks that read() sees
+   the change while the file is still mapped, then writes to the
+   file with write() and checks that the mapping sees that. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/vm/sample.inc"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define ACTUAL ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  static const char overwrite[] = "Now is the time for all good...";
+  static char buf[sizeof sample - 1];
+  size_t size = strlen (sample);
+  int handle;
+  void *map;
+
+  CHECK (create ("sample.txt", size), "create \"sample.txt\"");
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (write (handle, sample, size) == (int) size, "write \"sample.txt\"");
+  CHECK ((map = mmap (ACTUAL, 4096, 1, handle, 0)) != MAP_FAILED,
+         "mmap \"sample.txt\"");
+
+  /* A write through the mapping is seen by read() at once. */
+  memcpy (ACTUAL, overwrite, strlen (overwrite));
+  seek (handle, 0);
+  CHECK (read (handle, buf, size) == (int) size, "read \"sample.txt\"");
+  if (memcmp (buf, overwrite, strlen (overwrite))
+      || memcmp (buf + strlen (overwrite), sample + strlen (overwrite),
+                 size - strlen (overwrite)))
+    fail ("read() did not see the write through the mapping");
+
+  /* A write() is seen by the mapping at once. */
+  seek (handle, 0);
+  CHECK (write (handle, sample, size) == (int) size,
+         "write \"sample.txt\" again");
+  if (memcmp (ACTUAL, sample, size))
+    fail ("mapping did not see the write()");
+
+  munmap (map);
+  close (handle);
+  msg ("mapping and file agree");
+}
@@ -0,0 +1,78 @@
+/* Gives each kind of advice on a large file mapping.  The data read
+   through the mapping must not depend on the advice, and a page
+   dropped with MADV_DONTNEED must keep what was written to it. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+#define SIZE (PAGE_CNT * PAGE_SIZE)
+#define ACTUAL ((char *) 0x10000000)
+
+static char buf[PAGE_SIZE];
+
+/* Checks that every page I of the mapping is filled with I + 1,
+   except for page 9, which holds 'x' once REWRITTEN. */
+static void
+check_map (bool rewritten)
+{
+  int i, j;
+
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      char value = rewritten && i == 9 ? 'x' : i + 1;
+
+      for (j = 0; j < PAGE_SIZE; j++)
+        if (ACTUAL[i * PAGE_SIZE + j] != value)
+          fail ("byte %d of page %d is %d instead of %d",
+                j, i, ACTUAL[i * PAGE_SIZE + j], value);
+    }
+}
+
+void
+test_main (void)
+{
+  int handle, i;
+  void *map;
+
+  CHECK (create ("large.txt", SIZE), "create \"large.txt\"");
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      memset (buf, i + 1, PAGE_SIZE);
+      if (write (handle, buf, PAGE_SIZE) != PAGE_SIZE)
+        fail ("write of page %d failed", i);
+    }
+  msg ("write \"large.txt\"");
+  CHECK ((map = mmap (ACTUAL, SIZE, 1, handle, 0)) != MAP_FAILED,
+         "mmap \"large.txt\"");
+
+  CHECK (madvise (map, SIZE, MADV_SEQUENTIAL) == 0, "madvise sequential");
+  check_map (false);
+  msg ("sequential read ok");
+
+  memset (ACTUAL + 9 * PAGE_SIZE, 'x', PAGE_SIZE);
+  CHECK (madvise (map, SIZE, MADV_DONTNEED) == 0, "madvise dontneed");
+  seek (handle, 9 * PAGE_SIZE);
+  CHECK (read (handle, buf, PAGE_SIZE) == PAGE_SIZE && buf[0] == 'x'
+         && buf[PAGE_SIZE - 1] == 'x', "dropped page was written back");
+
+  CHECK (madvise (map, SIZE, MADV_RANDOM) == 0, "madvise random");
+  check_map (true);
+  msg ("random read ok");
+
+  CHECK (madvise (map, SIZE, MADV_WILLNEED) == 0, "madvise willneed");
+  CHECK (madvise (map, SIZE, MADV_NORMAL) == 0, "madvise normal");
+  check_map (true);
+  msg ("read after willneed ok");
+
+  CHECK (madvise (map, SIZE, 42) == -1, "unknown advice fails");
+  CHECK (madvise (ACTUAL + SIZE, PAGE_SIZE, MADV_WILLNEED) == -1,
+         "advice on unmapped memory fails");
+
+  munmap (map);
+  close (handle);
+}
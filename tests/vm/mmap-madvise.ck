@@ -0,0 +1,24 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-madvise) begin
+(mmap-madvise) create "large.txt"
+(mmap-madvise) open "large.txt"
+(mmap-madvise) write "large.txt"
+(mmap-madvise) mmap "large.txt"
+(mmap-madvise) madvise sequential
+(mmap-madvise) sequential read ok
+(mmap-madvise) madvise dontneed
+(mmap-madvise) dropped page was written back
+(mmap-madvise) madvise random
+(mmap-madvise) random read ok
+(mmap-madvise) madvise willneed
+(mmap-madvise) madvise normal
+(mmap-madvise) read after willneed ok
+(mmap-madvise) unknown advice fails
+(mmap-madvise) advice on unmapped memory fails
+(mmap-madvise) end
+EOF
+pass;
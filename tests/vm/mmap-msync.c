@@ -0,0 +1,66 @@
+/* Writes a large file through a mapping and flushes it with msync,
+   then reads the data back with the read system call while the
+   mapping is still in place.  Rewrites a single page and flushes
+   only that page.  msync writes runs of adjacent dirty pages with one
+   write each: see the write-back line of the VM statistics printed at
+   shutdown for the number of writes. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_CNT 64
+#define ACTUAL ((char *) 0x10000000)
+
+static char buf[PAGE_SIZE];
+
+static void
+check_page (int handle, int page, char value)
+{
+  int i;
+
+  seek (handle, page * PAGE_SIZE);
+  if (read (handle, buf, PAGE_SIZE) != PAGE_SIZE)
+    fail ("read of page %d failed", page);
+  for (i = 0; i < PAGE_SIZE; i++)
+    if (buf[i] != value)
+      fail ("byte %d of page %d is %d instead of %d",
+            i, page, buf[i], value);
+}
+
+void
+test_main (void)
+{
+  int handle, i;
+  void *map;
+
+  CHECK (create ("large.txt", PAGE_CNT * PAGE_SIZE), "create \"large.txt\"");
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  CHECK ((map = mmap (ACTUAL, PAGE_CNT * PAGE_SIZE, 1, handle, 0))
+         != MAP_FAILED, "mmap \"large.txt\"");
+
+  for (i = 0; i < PAGE_CNT; i++)
+    memset (ACTUAL + i * PAGE_SIZE, i + 1, PAGE_SIZE);
+  CHECK (msync (map, PAGE_CNT * PAGE_SIZE, MS_SYNC) == 0,
+         "msync \"large.txt\"");
+  for (i = 0; i < PAGE_CNT; i++)
+    check_page (handle, i, i + 1);
+  msg ("file holds the mapped data");
+
+  memset (ACTUAL + 5 * PAGE_SIZE, 'x', PAGE_SIZE);
+  CHECK (msync (ACTUAL + 5 * PAGE_SIZE, PAGE_SIZE, MS_SYNC) == 0,
+         "msync one page");
+  check_page (handle, 5, 'x');
+  check_page (handle, 6, 7);
+  msg ("file holds the rewritten page");
+
+  CHECK (msync (ACTUAL + 1, PAGE_SIZE, MS_SYNC) == -1,
+         "msync of misaligned address fails");
+  CHECK (msync (ACTUAL + PAGE_CNT * PAGE_SIZE, PAGE_SIZE, MS_SYNC) == -1,
+         "msync of unmapped memory fails");
+
+  munmap (map);
+  close (handle);
+}
@@ -0,0 +1,18 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-msync) begin
+(mmap-msync) create "large.txt"
+(mmap-msync) open "large.txt"
+(mmap-msync) mmap "large.txt"
+(mmap-msync) msync "large.txt"
+(mmap-msync) file holds the mapped data
+(mmap-msync) msync one page
+(mmap-msync) file holds the rewritten page
+(mmap-msync) msync of misaligned address fails
+(mmap-msync) msync of unmapped memory fails
+(mmap-msync) end
+EOF
+pass;
@@ -0,0 +1,28 @@
+/* Verifies that mapping into the range the stack may still grow into,
+   or into the guard gap below it, is disallowed, even though nothing
+   is mapped there yet.  A mapping below the gap is fine. */
+
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define USER_STACK 0x47480000
+#define STACK_LIMIT (USER_STACK - 1024 * 1024)
+#define GAP_LIMIT (STACK_LIMIT - 256 * 1024)
+
+void
+test_main (void) 
+{
+  int handle;
+  void *map;
+
+  CHECK ((handle = open ("sample.txt")) > 1, "open \"sample.txt\"");
+  CHECK (mmap ((void *) STACK_LIMIT, 4096, 0, handle, 0) == MAP_FAILED,
+         "try to mmap where the stack may grow");
+  CHECK (mmap ((void *) (GAP_LIMIT + 4096), 4096, 0, handle, 0) == MAP_FAILED,
+         "try to mmap in the stack guard gap");
+  CHECK ((map = mmap ((void *) (GAP_LIMIT - 4096), 4096, 0, handle, 0))
+         != MAP_FAILED, "mmap below the stack guard gap");
+  munmap (map);
+}
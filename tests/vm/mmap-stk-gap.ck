@@ -0,0 +1,13 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-stk-gap) begin
+(mmap-stk-gap) open "sample.txt"
+(mmap-stk-gap) try to mmap where the stack may grow
+(mmap-stk-gap) try to mmap in the stack guard gap
+(mmap-stk-gap) mmap below the stack guard gap
+(mmap-stk-gap) end
+EOF
+pass;
@@ -0,0 +1,44 @@
+/* Dirties every page of a 64 MiB file mapping and unmaps it, then
+   reads the file back to check that every page was written.  Serves
+   as a benchmark of the write-back at munmap: see the munmap and
+   write-back lines of the VM statistics printed at shutdown. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define SIZE (64 * 1024 * 1024)
+#define PAGE_CNT (SIZE / PAGE_SIZE)
+#define ACTUAL ((char *) 0x10000000)
+
+void
+test_main (void)
+{
+  int handle, i;
+  void *map;
+
+  CHECK (create ("large.txt", SIZE), "create \"large.txt\"");
+  CHECK ((handle = open ("large.txt")) > 1, "open \"large.txt\"");
+  CHECK ((map = mmap (ACTUAL, SIZE, 1, handle, 0)) != MAP_FAILED,
+         "mmap \"large.txt\"");
+
+  for (i = 0; i < PAGE_CNT; i++)
+    *(int *) (ACTUAL + i * PAGE_SIZE) = i;
+  msg ("dirty every page");
+
+  munmap (map);
+  msg ("munmap \"large.txt\"");
+
+  for (i = 0; i < PAGE_CNT; i++)
+    {
+      int value;
+
+      seek (handle, i * PAGE_SIZE);
+      if (read (handle, &value, sizeof value) != sizeof value || value != i)
+        fail ("page %d was not written back", i);
+    }
+  msg ("every page was written back");
+  close (handle);
+}
@@ -0,0 +1,15 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(mmap-unmap-large) begin
+(mmap-unmap-large) create "large.txt"
+(mmap-unmap-large) open "large.txt"
+(mmap-unmap-large) mmap "large.txt"
+(mmap-unmap-large) dirty every page
+(mmap-unmap-large) munmap "large.txt"
+(mmap-unmap-large) every page was written back
+(mmap-unmap-large) end
+EOF
+pass;
@@ -0,0 +1,59 @@
+/* Fills more anonymous memory than fits in RAM with a mix of pages
+   that compress well and pages that do not, then checks every page.
+   With the compressed swap cache, the first kind is kept in its pool
+   and the second written to the swap disk, and the pool fills up and
+   writes pages back as well.  For this test, Pintos memory size is
+   10MB. */
+
+#include <string.h>
+#include <stdint.h>
+#include <syscall.h>
+#include "tests/arc4.h"
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define CHUNK_SIZE (20 * 1024 * 1024)
+#define PAGE_COUNT (CHUNK_SIZE / PAGE_SIZE)
+
+static char big_chunk[CHUNK_SIZE];
+
+/* Fills PAGE, the page with index I, with random bytes if I is a
+   multiple of 4, and with a short repeating pattern otherwise. */
+static void
+fill_page (char *page, size_t i)
+{
+  if (i % 4 == 0)
+    {
+      struct arc4 arc4;
+
+      arc4_init (&arc4, &i, sizeof i);
+      arc4_crypt (&arc4, page, PAGE_SIZE);
+    }
+  else
+    {
+      size_t j;
+
+      for (j = 0; j < PAGE_SIZE; j++)
+        page[j] = "compressible"[j % 12] + i;
+    }
+}
+
+void
+test_main (void)
+{
+  static char expected[PAGE_SIZE];
+  size_t i;
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    fill_page (big_chunk + i * PAGE_SIZE, i);
+  msg ("filled %d pages", PAGE_COUNT);
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    {
+      fill_page (expected, i);
+      if (memcmp (big_chunk + i * PAGE_SIZE, expected, PAGE_SIZE))
+        fail ("page %zu is inconsistent", i);
+    }
+  msg ("checked %d pages", PAGE_COUNT);
+}
@@ -0,0 +1,11 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(swap-compress) begin
+(swap-compress) filled 5120 pages
+(swap-compress) checked 5120 pages
+(swap-compress) end
+EOF
+pass;
@@ -0,0 +1,76 @@
+/* Reads the memory use of the process with vmstat() while it touches
+   fresh memory, grows its stack and writes to memory shared with a
+   forked child, and checks that the counters follow. */
+
+#include <string.h>
+#include <syscall.h>
+#include "tests/lib.h"
+#include "tests/main.h"
+
+#define PAGE_SIZE 4096
+#define PAGE_COUNT 64
+
+static char buf[PAGE_COUNT * PAGE_SIZE];
+
+/* Touches a large object on the stack. */
+static void __attribute__ ((noinline))
+use_stack (void)
+{
+  volatile char stack_obj[16 * PAGE_SIZE];
+  size_t i;
+
+  for (i = 0; i < sizeof stack_obj; i += PAGE_SIZE)
+    stack_obj[i] = i;
+}
+
+void
+test_main (void)
+{
+  struct vmstat before, after;
+  size_t i;
+  int pid;
+
+  CHECK (vmstat (&before) == 0, "vmstat");
+
+  for (i = 0; i < PAGE_COUNT; i++)
+    buf[i * PAGE_SIZE] = i;
+  CHECK (vmstat (&after) == 0, "vmstat after touching %d pages", PAGE_COUNT);
+  if (after.minor_faults + after.major_faults
+      <= before.minor_faults + before.major_faults)
+    fail ("touching new pages caused no faults");
+  if (after.resident < before.resident + PAGE_COUNT)
+    fail ("%lu pages resident, expected at least %lu",
+          after.resident, before.resident + PAGE_COUNT);
+  if (after.wss[0] < PAGE_COUNT)
+    fail ("working set of %lu pages, expected at least %d",
+          after.wss[0], PAGE_COUNT);
+  if (after.wss[0] > after.wss[1] || after.wss[1] > after.wss[2])
+    fail ("working set shrinks over longer windows");
+
+  before = after;
+  use_stack ();
+  CHECK (vmstat (&after) == 0, "vmstat after growing the stack");
+  if (after.stack_faults <= before.stack_faults)
+    fail ("stack growth not counted");
+
+  pid = fork ("child");
+  if (pid == 0)
+    {
+      CHECK (vmstat (&before) == 0, "vmstat in child");
+      buf[0]++;
+      CHECK (vmstat (&after) == 0, "vmstat after writing shared page");
+      if (after.cow_faults <= before.cow_faults)
+        fail ("copy-on-write fault not counted");
+      exit (0);
+    }
+  CHECK (wait (pid) == 0, "wait for child");
+
+  msg ("vmstat on a kernel address");
+  pid = fork ("bad");
+  if (pid == 0)
+    {
+      vmstat ((struct vmstat *) 0x8004000000);
+      fail ("vmstat on a kernel address returned");
+    }
+  CHECK (wait (pid) == -1, "bad vmstat killed the child");
+}
@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected (IGNORE_EXIT_CODES => 1, [<<'EOF']);
+(vm-stat) begin
+(vm-stat) vmstat
+(vm-stat) vmstat after touching 64 pages
+(vm-stat) vmstat after growing the stack
+(vm-stat) vmstat in child
+(vm-stat) vmstat after writing shared page
+(vm-stat) wait for child
+(vm-stat) vmstat on a kernel address
+(vm-stat) bad vmstat killed the child
+(vm-stat) end
+EOF
+pass;
@@ -3,6 +3,7 @@
 #include <debug.h>
 #include <limits.h>
 #include <random.h>
+#include <round.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -21,6 +22,7 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "intrinsic.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -34,6 +36,7 @@
 #endif
 #ifdef FILESYS
 #include "devices/disk.h"
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -49,13 +52,26 @@ static bool format_filesys;
 /* -q: Power off after kernel tasks complete? */
 bool power_off_when_done;
 
+/* -small-pages: Map the kernel direct map with 4 kB pages only? */
+static bool small_pages_only;
+
+/* Boot timing, in TSC cycles. */
+static uint64_t boot_start_tsc;     /* Time stamp at entry to main(). */
+static uint64_t boot_cycles;        /* From main() to "Boot complete". */
+static uint64_t paging_cycles;      /* Spent in paging_init(). */
+
 bool thread_tests;
 
 static void bss_init (void);
 static void paging_init (uint64_t mem_end);
+static void direct_map_bench (uint64_t mem_end);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
+#ifdef VM
+static void parse_wmark (char *value);
+static void parse_stack_chunk (char *value);
+#endif
 static void run_actions (char **argv);
 static void usage (void);
 
@@ -67,11 +83,12 @@ int main (void) NO_RETURN;
 /* Pintos main program. */
 int
 main (void) {
-	uint64_t mem_end;
+	uint64_t mem_end, start;
 	char **argv;
 
 	/* Clear BSS and get machine's RAM size. */
 	bss_init ();
+	boot_start_tsc = rdtsc ();
 
 	/* Break command line into arguments and parse options. */
 	argv = read_command_line ();
@@ -85,7 +102,10 @@ main (void) {
 	/* Initialize memory system. */
 	mem_end = palloc_init ();
 	malloc_init ();
+	start = rdtsc ();
 	paging_init (mem_end);
+	paging_cycles = rdtsc () - start;
+	direct_map_bench (mem_end);
 
 #ifdef USERPROG
 	tss_init ();
@@ -116,6 +136,7 @@ main (void) {
 	vm_init ();
 #endif
 
+	boot_cycles = rdtsc () - boot_start_tsc;
 	printf ("Boot complete.\n");
 
 	/* Run actions specified on kernel command line. */
@@ -140,9 +161,33 @@ bss_init (void) {
 	memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
+/* Number of direct-map entries of each size installed by paging_init(). */
+static size_t huge_page_cnt, large_page_cnt, small_page_cnt;
+
+/* Result of direct_map_bench(). */
+static size_t dmap_bench_pages;     /* Pages touched per pass. */
+static uint64_t dmap_bench_cycles;  /* Cycles of the second pass. */
+
+/* Returns true if the CPU can map 1 GiB pages (CPUID.80000001H:EDX[26]). */
+static bool
+cpu_has_huge_pages (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (0x80000000, &eax, &ebx, &ecx, &edx);
+	if (eax < 0x80000001)
+		return false;
+	cpuid (0x80000001, &eax, &ebx, &ecx, &edx);
+	return (edx & (1 << 26)) != 0;
+}
+
 /* Populates the page table with the kernel virtual mapping,
  * and then sets up the CPU to use the new page directory.
- * Points base_pml4 to the pml4 it creates. */
+ * Points base_pml4 to the pml4 it creates.
+ *
+ * Physical memory is mapped with the largest page that both the
+ * physical and virtual addresses are aligned to: 1 GiB when the CPU
+ * supports it, then 2 MiB.  Any 2 MiB region that overlaps the kernel
+ * text is mapped with 4 kB pages so the text can stay read-only. */
 static void
 paging_init (uint64_t mem_end) {
 	uint64_t *pml4, *pte;
@@ -150,21 +195,70 @@ paging_init (uint64_t mem_end) {
 	pml4 = base_pml4 = palloc_get_page (PAL_ASSERT | PAL_ZERO);
 
 	extern char start, _end_kernel_text;
+	uint64_t text_start = ROUND_DOWN ((uint64_t) &start, LARGE_PGSIZE);
+	uint64_t text_end = ROUND_UP ((uint64_t) &_end_kernel_text, LARGE_PGSIZE);
+	bool huge_ok = !small_pages_only && cpu_has_huge_pages ();
+
 	// Maps physical address [0 ~ mem_end] to
 	//   [LOADER_KERN_BASE ~ LOADER_KERN_BASE + mem_end].
-	for (uint64_t pa = 0; pa < mem_end; pa += PGSIZE) {
+	for (uint64_t pa = 0; pa < mem_end; ) {
 		uint64_t va = (uint64_t) ptov(pa);
 
+		if (huge_ok && va % HUGE_PGSIZE == 0 && pa + HUGE_PGSIZE <= mem_end
+				&& (va + HUGE_PGSIZE <= text_start || text_end <= va)) {
+			if ((pte = pml4e_walk_large (pml4, va, HUGE_PGSIZE, 1)) != NULL)
+				*pte = pa | PTE_PS | PTE_P | PTE_W;
+			huge_page_cnt++;
+			pa += HUGE_PGSIZE;
+			continue;
+		}
+
+		if (!small_pages_only
+				&& va % LARGE_PGSIZE == 0 && pa + LARGE_PGSIZE <= mem_end
+				&& (va + LARGE_PGSIZE <= text_start || text_end <= va)) {
+			if ((pte = pml4e_walk_large (pml4, va, LARGE_PGSIZE, 1)) != NULL)
+				*pte = pa | PTE_PS | PTE_P | PTE_W;
+			large_page_cnt++;
+			pa += LARGE_PGSIZE;
+			continue;
+		}
+
 		perm = PTE_P | PTE_W;
 		if ((uint64_t) &start <= va && va < (uint64_t) &_end_kernel_text)
 			perm &= ~PTE_W;
 
 		if ((pte = pml4e_walk (pml4, va, 1)) != NULL)
 			*pte = pa | perm;
+		small_page_cnt++;
+		pa += PGSIZE;
 	}
 
 	// reload cr3
 	pml4_activate(0);
+	pcid_init ();
+}
+
+/* Reads one word of every page of physical memory above 1 MB through
+ * the direct map, twice, and records how long the second pass took.
+ * With more memory than the TLB covers, every read of the second pass
+ * misses the TLB when the direct map uses 4 kB pages, so comparing a
+ * boot with -small-pages against one without shows what the larger
+ * pages save on TLB misses. */
+static void
+direct_map_bench (uint64_t mem_end) {
+	uint64_t start = 0, pa;
+	int pass;
+
+	for (pass = 0; pass < 2; pass++) {
+		if (pass == 1)
+			start = rdtsc ();
+		dmap_bench_pages = 0;
+		for (pa = 0x100000; pa < mem_end; pa += PGSIZE) {
+			(void) *(volatile uint64_t *) ptov (pa);
+			dmap_bench_pages++;
+		}
+	}
+	dmap_bench_cycles = rdtsc () - start;
 }
 
 /* Breaks the kernel command line into words and returns them as
@@ -221,11 +315,21 @@ parse_options (char **argv) {
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-small-pages"))
+			small_pages_only = true;
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
 		else if (!strcmp (name, "-threads-tests"))
 			thread_tests = true;
+#endif
+#ifdef VM
+		else if (!strcmp (name, "-wmark"))
+			parse_wmark (value);
+		else if (!strcmp (name, "-stack-chunk"))
+			parse_stack_chunk (value);
+		else if (!strcmp (name, "-exit-vmstat"))
+			vm_exit_stats = true;
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -234,6 +338,39 @@ parse_options (char **argv) {
 	return argv;
 }
 
+#ifdef VM
+/* Sets the free page watermarks of the page reclaimer from VALUE,
+   formatted as MIN,LOW,HIGH. */
+static void
+parse_wmark (char *value) {
+	char *save_ptr;
+	char *min, *low, *high;
+
+	if (value == NULL
+			|| (min = strtok_r (value, ",", &save_ptr)) == NULL
+			|| (low = strtok_r (NULL, ",", &save_ptr)) == NULL
+			|| (high = strtok_r (NULL, ",", &save_ptr)) == NULL)
+		PANIC ("-wmark requires MIN,LOW,HIGH");
+
+	vm_wmark_min = atoi (min);
+	vm_wmark_low = atoi (low);
+	vm_wmark_high = atoi (high);
+	if (vm_wmark_low < vm_wmark_min || vm_wmark_high < vm_wmark_low)
+		PANIC ("-wmark requires MIN <= LOW <= HIGH");
+}
+
+/* Sets the least number of pages the user stack grows by at once from
+   VALUE. */
+static void
+parse_stack_chunk (char *value) {
+	int pages = value != NULL ? atoi (value) : 0;
+
+	if (pages <= 0)
+		PANIC ("-stack-chunk requires a positive number of pages");
+	vm_stack_chunk = pages;
+}
+#endif
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv) {
@@ -326,8 +463,17 @@ usage (void) {
 			"  -f                 Format file system disk during startup.\n"
 			"  -rs=SEED           Set random number seed to SEED.\n"
 			"  -mlfqs             Use multi-level feedback queue scheduler.\n"
+			"  -small-pages       Map all memory with 4 kB kernel pages.\n"
 #ifdef USERPROG
 			"  -ul=COUNT          Limit user memory to COUNT pages.\n"
+#endif
+#ifdef VM
+			"  -wmark=MIN,LOW,HIGH  Reclaim user memory when fewer pages\n"
+			"                     are free (default: derived from pool size).\n"
+			"  -stack-chunk=PAGES Grow the user stack by at least PAGES\n"
+			"                     pages at a time (default: 4).\n"
+			"  -exit-vmstat       Print the faults and working set of\n"
+			"                     every process when it exits.\n"
 #endif
 			);
 	power_off ();
@@ -352,14 +498,27 @@ power_off (void) {
 /* Print statistics about Pintos execution. */
 static void
 print_stats (void) {
+	printf ("Paging: %zu 1 GiB, %zu 2 MiB, %zu 4 kB kernel mappings, "
+			"set up in %llu cycles\n", huge_page_cnt, large_page_cnt,
+			small_page_cnt, (unsigned long long) paging_cycles);
+	printf ("Paging: direct map sweep of %zu pages in %llu cycles, "
+			"boot in %llu cycles\n", dmap_bench_pages,
+			(unsigned long long) dmap_bench_cycles,
+			(unsigned long long) boot_cycles);
+	tlb_print_stats ();
 	timer_print_stats ();
 	thread_print_stats ();
 #ifdef FILESYS
 	disk_print_stats ();
+	cache_print_stats ();
 #endif
 	console_print_stats ();
 	kbd_print_stats ();
 #ifdef USERPROG
 	exception_print_stats ();
+	process_print_stats ();
+#endif
+#ifdef VM
+	vm_print_stats ();
 #endif
 }
@@ -1,13 +1,19 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/pte.h"
 #include "threads/palloc.h"
 #include "threads/thread.h"
 #include "threads/mmu.h"
 #include "intrinsic.h"
 
+static void pcid_release (uint64_t *pml4);
+static void tlb_invalidate (uint64_t *pml4, const void *upage);
+static void tlb_flush (uint64_t *pml4);
+
 static uint64_t *
 pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 	int idx = PDX (va);
@@ -23,6 +29,9 @@ pgdir_walk (uint64_t *pdp, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		/* A 2 MiB mapping has no page table below it. */
+		if (pdp[idx] & PTE_PS)
+			return NULL;
 		return (uint64_t *) ptov (PTE_ADDR (pdp[idx]) + 8 * PTX (va));
 	}
 	return NULL;
@@ -46,6 +55,9 @@ pdpe_walk (uint64_t *pdpe, const uint64_t va, int create) {
 			} else
 				return NULL;
 		}
+		/* A 1 GiB mapping has no page directory below it. */
+		if (pdpe[idx] & PTE_PS)
+			return NULL;
 		pte = pgdir_walk (ptov (PTE_ADDR (pdpe[idx])), va, create);
 	}
 	if (pte == NULL && allocated) {
@@ -88,8 +100,66 @@ pml4e_walk (uint64_t *pml4e, const uint64_t va, int create) {
 	return pte;
 }
 
+/* Returns the address of the entry that maps the SIZE-byte large page
+ * containing VA in page map level 4, pml4.  SIZE must be LARGE_PGSIZE,
+ * for which the page-directory entry is returned, or HUGE_PGSIZE, for
+ * which the page-directory-pointer entry is returned.  The caller
+ * stores the frame address with PTE_PS into the returned entry.
+ * Missing upper-level tables are created if CREATE is true; otherwise
+ * a null pointer is returned. */
+uint64_t *
+pml4e_walk_large (uint64_t *pml4e, const uint64_t va, uint64_t size,
+		int create) {
+	ASSERT (size == LARGE_PGSIZE || size == HUGE_PGSIZE);
+	ASSERT (va % size == 0);
+
+	int idx = PML4 (va);
+	if (!(pml4e[idx] & PTE_P)) {
+		uint64_t *new_page;
+		if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+			return NULL;
+		pml4e[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+
+	uint64_t *pdpe = ptov (PTE_ADDR (pml4e[idx]));
+	if (size == HUGE_PGSIZE)
+		return &pdpe[PDPE (va)];
+
+	idx = PDPE (va);
+	if (!(pdpe[idx] & PTE_P)) {
+		uint64_t *new_page;
+		if (!create || (new_page = palloc_get_page (PAL_ZERO)) == NULL)
+			return NULL;
+		pdpe[idx] = vtop (new_page) | PTE_U | PTE_W | PTE_P;
+	}
+	ASSERT (!(pdpe[idx] & PTE_PS));
+
+	uint64_t *pgdir = ptov (PTE_ADDR (pdpe[idx]));
+	return &pgdir[PDX (va)];
+}
+
+/* Returns the entry that maps user virtual address VA in PML4: the
+ * page-table entry for a 4 kB page, or the page-directory entry when VA
+ * lies in a 2 MiB page.  Stores the size of the mapping in *SIZE.
+ * Returns a null pointer if no table covers VA. */
+static uint64_t *
+pml4e_lookup (uint64_t *pml4, const uint64_t va, uint64_t *size) {
+	uint64_t *pde = pml4e_walk_large (pml4, va & ~(LARGE_PGSIZE - 1),
+			LARGE_PGSIZE, false);
+
+	if (pde != NULL && (*pde & (PTE_P | PTE_PS)) == (PTE_P | PTE_PS)) {
+		*size = LARGE_PGSIZE;
+		return pde;
+	}
+	*size = PGSIZE;
+	return pml4e_walk (pml4, va, false);
+}
+
 /* Creates a new page map level 4 (pml4) has mappings for kernel
  * virtual addresses, but none for user virtual addresses.
+ * The kernel half is shared rather than copied: only the top-level
+ * entries are duplicated, so every pml4 points at the same
+ * page-directory-pointer tables (and large pages) of base_pml4.
  * Returns the new page directory, or a null pointer if memory
  * allocation fails. */
 uint64_t *
@@ -122,6 +192,9 @@ pgdir_for_each (uint64_t *pdp, pte_for_each_func *func, void *aux,
 		unsigned pml4_index, unsigned pdp_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pte = ptov((uint64_t *) pdp[i]);
+		/* Large pages are kernel direct-map entries; skip them. */
+		if (((uint64_t) pte) & PTE_PS)
+			continue;
 		if (((uint64_t) pte) & PTE_P)
 			if (!pt_for_each ((uint64_t *) PTE_ADDR (pte), func, aux,
 					pml4_index, pdp_index, i))
@@ -135,6 +208,8 @@ pdp_for_each (uint64_t *pdp,
 		pte_for_each_func *func, void *aux, unsigned pml4_index) {
 	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
 		uint64_t *pde = ptov((uint64_t *) pdp[i]);
+		if (((uint64_t) pde) & PTE_PS)
+			continue;
 		if (((uint64_t) pde) & PTE_P)
 			if (!pgdir_for_each ((uint64_t *) PTE_ADDR (pde), func,
 					 aux, pml4_index, i))
@@ -155,34 +230,135 @@ pml4_for_each (uint64_t *pml4, pte_for_each_func *func, void *aux) {
 	return true;
 }
 
-static void
-pt_destroy (uint64_t *pt) {
-	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
-		uint64_t *pte = ptov((uint64_t *) pt[i]);
-		if (((uint64_t) pte) & PTE_P)
-			palloc_free_page ((void *) PTE_ADDR (pte));
+/* Range walkers.
+ *
+ * The walkers below visit only the part of a page map that covers a
+ * range of addresses, and at each level go straight from one present
+ * entry to the next: a sparse address space costs a few table scans,
+ * not one step per page it could map.  At the bottom they work on runs
+ * of consecutive present entries of one page table at a time. */
+
+/* Bytes mapped by one entry of a table at LEVEL, 0 being a page table
+ * and 3 the pml4. */
+#define LEVEL_SPAN(LEVEL) (1ULL << (PTXSHIFT + 9 * (LEVEL)))
+
+/* Calls FUNC on each run of present 4 kB entries of TABLE, a table at
+ * LEVEL whose first entry maps BASE, that map pages in [START, END).
+ * Large pages are skipped.  Stops and returns false as soon as FUNC
+ * does. */
+static bool
+table_for_each_run (uint64_t *table, int level, uint64_t base,
+		uint64_t start, uint64_t end, pte_run_func *func, void *aux) {
+	uint64_t span = LEVEL_SPAN (level);
+	unsigned i = start > base ? (start - base) / span : 0;
+	unsigned n = (end - base + span - 1) / span;
+
+	if (n > PGSIZE / sizeof (uint64_t))
+		n = PGSIZE / sizeof (uint64_t);
+
+	while (i < n) {
+		unsigned j;
+
+		if (!(table[i] & PTE_P) || (level > 0 && (table[i] & PTE_PS))) {
+			i++;
+			continue;
+		}
+		if (level > 0) {
+			if (!table_for_each_run (ptov (PTE_ADDR (table[i])), level - 1,
+						base + i * span, start, end, func, aux))
+				return false;
+			i++;
+			continue;
+		}
+		for (j = i + 1; j < n && (table[j] & PTE_P); j++)
+			continue;
+		if (!func (&table[i], j - i, (void *) (base + i * span), aux))
+			return false;
+		i = j;
 	}
-	palloc_free_page ((void *) pt);
+	return true;
 }
 
-static void
-pgdir_destroy (uint64_t *pdp) {
-	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
-		uint64_t *pte = ptov((uint64_t *) pdp[i]);
-		if (((uint64_t) pte) & PTE_P)
-			pt_destroy (PTE_ADDR (pte));
+/* Calls FUNC on each run of present 4 kB entries of PML4 that map user
+ * pages in [START, END), with the first entry of the run, the number
+ * of entries and the address the first one maps.  A run never crosses
+ * a page table.  Returns false if FUNC returned false, which stops the
+ * walk, and true otherwise. */
+bool
+pml4_for_each_run (uint64_t *pml4, void *start, void *end,
+		pte_run_func *func, void *aux) {
+	ASSERT (pg_ofs (start) == 0 && pg_ofs (end) == 0);
+	ASSERT ((uint64_t) end <= KERN_BASE);
+
+	if (start >= end)
+		return true;
+	return table_for_each_run (pml4, 3, 0, (uint64_t) start, (uint64_t) end,
+			func, aux);
+}
+
+/* Copies the run of CNT entries at PTE, mapping VA, into DST_, the
+ * page map being filled by pml4_copy_range(), with a copy of each
+ * page.  The entries of the run share one page table in DST_ as well,
+ * so it is looked up once. */
+static bool
+copy_run (uint64_t *pte, size_t cnt, void *va, void *dst_) {
+	uint64_t *dst = pml4e_walk (dst_, (uint64_t) va, 1);
+
+	if (dst == NULL)
+		return false;
+	for (size_t i = 0; i < cnt; i++) {
+		void *kpage = palloc_get_page (PAL_USER);
+
+		if (kpage == NULL)
+			return false;
+		memcpy (kpage, ptov (PTE_ADDR (pte[i])), PGSIZE);
+		dst[i] = vtop (kpage) | (pte[i] & (PTE_P | PTE_W | PTE_U));
 	}
-	palloc_free_page ((void *) pdp);
+	return true;
+}
+
+/* Maps a copy of every page that SRC maps in [START, END) into DST at
+ * the same address and with the same permission.  DST must map none of
+ * these pages yet.  Returns false if memory ran out; the pages copied
+ * so far stay in DST and are freed with it. */
+bool
+pml4_copy_range (uint64_t *dst, uint64_t *src, void *start, void *end) {
+	ASSERT (dst != base_pml4);
+	return pml4_for_each_run (src, start, end, copy_run, dst);
 }
 
+/* Frees the frames mapped by TABLE, a table at LEVEL, and the tables
+ * below it, then TABLE itself.  Frames that follow each other in both
+ * the table and physical memory are freed together. */
 static void
-pdpe_destroy (uint64_t *pdpe) {
-	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++) {
-		uint64_t *pde = ptov((uint64_t *) pdpe[i]);
-		if (((uint64_t) pde) & PTE_P)
-			pgdir_destroy ((void *) PTE_ADDR (pde));
+table_destroy (uint64_t *table, int level) {
+	const unsigned n = PGSIZE / sizeof (uint64_t);
+	unsigned i = 0;
+
+	while (i < n) {
+		uint64_t pa = PTE_ADDR (table[i]);
+		unsigned j;
+
+		if (!(table[i] & PTE_P)) {
+			i++;
+			continue;
+		}
+		if (level > 0) {
+			if (table[i] & PTE_PS) {
+				ASSERT (level == 1);
+				palloc_free_multiple (ptov (pa), LARGE_PGSIZE / PGSIZE);
+			} else
+				table_destroy (ptov (pa), level - 1);
+			i++;
+			continue;
+		}
+		for (j = i + 1; j < n && (table[j] & PTE_P)
+				&& PTE_ADDR (table[j]) == pa + (j - i) * PGSIZE; j++)
+			continue;
+		palloc_free_multiple (ptov (pa), j - i);
+		i = j;
 	}
-	palloc_free_page ((void *) pdpe);
+	palloc_free_page (table);
 }
 
 /* Destroys pml4e, freeing all the pages it references. */
@@ -193,17 +369,237 @@ pml4_destroy (uint64_t *pml4) {
 	ASSERT (pml4 != base_pml4);
 
 	/* if PML4 (vaddr) >= 1, it's kernel space by define. */
-	uint64_t *pdpe = ptov ((uint64_t *) pml4[0]);
-	if (((uint64_t) pdpe) & PTE_P)
-		pdpe_destroy ((void *) PTE_ADDR (pdpe));
+	if (pml4[0] & PTE_P)
+		table_destroy (ptov (PTE_ADDR (pml4[0])), 2);
+	pcid_release (pml4);
 	palloc_free_page ((void *) pml4);
 }
 
+/* Process-context identifiers.
+ *
+ * With PCIDs, the TLB tags each entry with the PCID that was in CR3
+ * when it was loaded, and a CR3 load with CR3_NOFLUSH keeps the entries
+ * of every PCID.  A process that runs again then finds its entries
+ * where it left them instead of refilling the TLB from scratch.
+ *
+ * The recently active page maps own one of PCID_CNT slots; PCID 0 is
+ * base_pml4's, whose kernel-only mappings never change.  Changing a
+ * page map that is not active cannot invalidate its entries, so its
+ * slot is marked stale instead and its PCID is flushed when it is
+ * activated next.  A page map without a slot gets the least recently
+ * used one, which is flushed as well.
+ *
+ * A page map must not be activated between the change of one of its
+ * entries and the invalidation, so both happen with interrupts off. */
+#define CR3_NOFLUSH (1ULL << 63)    /* Keep the TLB entries of the PCID. */
+#define CR4_PCIDE (1 << 17)         /* Enable PCIDs. */
+#define CPUID_PCID (1 << 17)        /* CPUID.01H:ECX, PCIDs supported. */
+#define PCID_CNT 8
+
+struct pcid_slot {
+	uint64_t *pml4;        /* Page map using PCID (index + 1), or NULL. */
+	bool stale;            /* TLB may hold entries PML4 no longer has. */
+	uint64_t last_used;    /* Value of pcid_clock at last activation. */
+};
+
+static bool pcid_enabled;
+static struct pcid_slot pcid_slots[PCID_CNT];
+static uint64_t pcid_clock;
+static uint64_t *active_pml4;      /* Page map loaded in CR3. */
+
+/* TLB statistics. */
+static size_t switch_cnt;          /* Page map switches. */
+static size_t switch_keep_cnt;     /* Switches that kept the TLB. */
+static size_t switch_flush_cnt;    /* Switches that flushed the PCID. */
+static size_t batch_cnt;           /* Batches that invalidated pages. */
+static size_t batch_page_cnt;      /* Pages invalidated with invlpg by them. */
+static size_t batch_flush_cnt;     /* Batches that flushed the TLB. */
+
+/* Above this number of pages, a batch flushes the whole TLB of the
+ * address space rather than invalidating each page. */
+#define TLB_FLUSH_CEILING 33
+
+/* Turns PCIDs on if the CPU has them.  Must run while CR3 holds PCID 0,
+ * as it does until then. */
+void
+pcid_init (void) {
+	uint32_t eax, ebx, ecx, edx;
+
+	cpuid (1, &eax, &ebx, &ecx, &edx);
+	if ((ecx & CPUID_PCID) == 0)
+		return;
+	lcr4 (rcr4 () | CR4_PCIDE);
+	pcid_enabled = true;
+}
+
+/* Returns the slot of PML4, or NULL if it has none. */
+static struct pcid_slot *
+pcid_lookup (uint64_t *pml4) {
+	for (int i = 0; i < PCID_CNT; i++)
+		if (pcid_slots[i].pml4 == pml4)
+			return &pcid_slots[i];
+	return NULL;
+}
+
+/* Returns the PCID of the active page map. */
+static uint64_t
+pcid_active (void) {
+	struct pcid_slot *slot;
+
+	if (!pcid_enabled || active_pml4 == base_pml4
+			|| (slot = pcid_lookup (active_pml4)) == NULL)
+		return 0;
+	return slot - pcid_slots + 1;
+}
+
+/* Returns the CR3 value that activates PML4 under its PCID, giving it
+ * a slot if it has none. */
+static uint64_t
+pcid_cr3 (uint64_t *pml4) {
+	struct pcid_slot *slot;
+
+	if (pml4 == base_pml4)
+		return vtop (pml4) | CR3_NOFLUSH;
+
+	slot = pcid_lookup (pml4);
+	if (slot == NULL) {
+		slot = &pcid_slots[0];
+		for (int i = 1; i < PCID_CNT; i++)
+			if (pcid_slots[i].last_used < slot->last_used)
+				slot = &pcid_slots[i];
+		slot->pml4 = pml4;
+		slot->stale = true;
+	}
+	slot->last_used = ++pcid_clock;
+
+	uint64_t cr3 = vtop (pml4) | (uint64_t) (slot - pcid_slots + 1);
+	if (slot->stale) {
+		slot->stale = false;
+		switch_flush_cnt++;
+		return cr3;
+	}
+	switch_keep_cnt++;
+	return cr3 | CR3_NOFLUSH;
+}
+
+/* Gives up the slot of PML4, which is being destroyed. */
+static void
+pcid_release (uint64_t *pml4) {
+	enum intr_level old_level = intr_disable ();
+	struct pcid_slot *slot = pcid_lookup (pml4);
+
+	if (slot != NULL) {
+		slot->pml4 = NULL;
+		slot->last_used = 0;
+	}
+	intr_set_level (old_level);
+}
+
 /* Loads page directory PD into the CPU's page directory base
  * register. */
 void
 pml4_activate (uint64_t *pml4) {
-	lcr3 (vtop (pml4 ? pml4 : base_pml4));
+	enum intr_level old_level = intr_disable ();
+
+	if (pml4 == NULL)
+		pml4 = base_pml4;
+	if (pml4 != active_pml4)
+		switch_cnt++;
+	active_pml4 = pml4;
+	lcr3 (pcid_enabled ? pcid_cr3 (pml4) : vtop (pml4));
+	intr_set_level (old_level);
+}
+
+/* Drops the TLB entry of UPAGE in PML4 after its entry changed.  If
+ * PML4 is active, the entry is invalidated now, or at the end of the
+ * current thread's batch; otherwise the TLB of PML4 is flushed when it
+ * is activated next.  Interrupts must be off. */
+static void
+tlb_invalidate (uint64_t *pml4, const void *upage) {
+	uint64_t va = (uint64_t) pg_round_down (upage);
+
+	if (pml4 != active_pml4) {
+		tlb_flush (pml4);
+		return;
+	}
+
+#ifdef USERPROG
+	struct tlb_batch *b = thread_current ()->tlb_batch;
+	if (b != NULL && b->pml4 == pml4) {
+		if (b->start == b->end) {
+			b->start = va;
+			b->end = va + PGSIZE;
+		} else if (va < b->start)
+			b->start = va;
+		else if (va >= b->end)
+			b->end = va + PGSIZE;
+		return;
+	}
+#endif
+	invlpg (va);
+}
+
+/* Drops every TLB entry of PML4, now if it is active and otherwise
+ * when it is activated next.  Interrupts must be off. */
+static void
+tlb_flush (uint64_t *pml4) {
+	struct pcid_slot *slot;
+
+	if (pml4 == active_pml4)
+		lcr3 (vtop (pml4) | pcid_active ());
+	else if (pcid_enabled && (slot = pcid_lookup (pml4)) != NULL)
+		slot->stale = true;
+}
+
+/* Opens batch B for the active page map of the current thread. */
+void
+tlb_batch_begin (struct tlb_batch *b UNUSED) {
+#ifdef USERPROG
+	struct thread *t = thread_current ();
+
+	b->pml4 = active_pml4;
+	b->start = b->end = 0;
+	b->outer = t->tlb_batch == NULL;
+	if (b->outer)
+		t->tlb_batch = b;
+#endif
+}
+
+/* Closes batch B, invalidating the pages it deferred if it is the
+ * outermost one. */
+void
+tlb_batch_end (struct tlb_batch *b UNUSED) {
+#ifdef USERPROG
+	if (!b->outer)
+		return;
+	thread_current ()->tlb_batch = NULL;
+	if (b->start == b->end)
+		return;
+
+	enum intr_level old_level = intr_disable ();
+	if (b->pml4 != active_pml4)
+		tlb_flush (b->pml4);
+	else if ((b->end - b->start) / PGSIZE > TLB_FLUSH_CEILING) {
+		tlb_flush (b->pml4);
+		batch_flush_cnt++;
+	} else {
+		for (uint64_t va = b->start; va < b->end; va += PGSIZE)
+			invlpg (va);
+		batch_page_cnt += (b->end - b->start) / PGSIZE;
+	}
+	batch_cnt++;
+	intr_set_level (old_level);
+#endif
+}
+
+/* Prints TLB statistics. */
+void
+tlb_print_stats (void) {
+	printf ("TLB: PCIDs %s, %zu page map switches, %zu kept the TLB, "
+			"%zu flushed it\n", pcid_enabled ? "on" : "off",
+			switch_cnt, switch_keep_cnt, switch_flush_cnt);
+	printf ("TLB: %zu batched invalidations, %zu pages invalidated, "
+			"%zu full flushes\n", batch_cnt, batch_page_cnt, batch_flush_cnt);
 }
 
 /* Looks up the physical address that corresponds to user virtual
@@ -214,10 +610,11 @@ void *
 pml4_get_page (uint64_t *pml4, const void *uaddr) {
 	ASSERT (is_user_vaddr (uaddr));
 
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) uaddr, 0);
+	uint64_t size;
+	uint64_t *pte = pml4e_lookup (pml4, (uint64_t) uaddr, &size);
 
 	if (pte && (*pte & PTE_P))
-		return ptov (PTE_ADDR (*pte)) + pg_ofs (uaddr);
+		return ptov (PTE_ADDR (*pte)) + ((uint64_t) uaddr & (size - 1));
 	return NULL;
 }
 
@@ -238,11 +635,77 @@ pml4_set_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
 
 	uint64_t *pte = pml4e_walk (pml4, (uint64_t) upage, 1);
 
-	if (pte)
+	if (pte) {
+		enum intr_level old_level = intr_disable ();
+		bool present = (*pte & PTE_P) != 0;
+
 		*pte = vtop (kpage) | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+		if (present)
+			tlb_invalidate (pml4, upage);
+		intr_set_level (old_level);
+	}
 	return pte != NULL;
 }
 
+/* Maps the LARGE_PGSIZE user region starting at UPAGE to the physically
+ * contiguous frames starting at KPAGE with a single page-directory entry.
+ * Both addresses must be LARGE_PGSIZE aligned.  An empty page table
+ * already covering the region is released; if any 4 kB page of the
+ * region is mapped, nothing is changed and false is returned.  Also
+ * returns false if memory allocation failed. */
+bool
+pml4_set_large_page (uint64_t *pml4, void *upage, void *kpage, bool rw) {
+	ASSERT ((uint64_t) upage % LARGE_PGSIZE == 0);
+	ASSERT ((uint64_t) kpage % LARGE_PGSIZE == 0);
+	ASSERT (is_user_vaddr (upage));
+	ASSERT (pml4 != base_pml4);
+
+	uint64_t *pde = pml4e_walk_large (pml4, (uint64_t) upage, LARGE_PGSIZE, 1);
+	if (pde == NULL)
+		return false;
+
+	if (*pde & PTE_P) {
+		uint64_t *pt;
+		if (*pde & PTE_PS)
+			return false;
+		pt = ptov (PTE_ADDR (*pde));
+		for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+			if (pt[i] & PTE_P)
+				return false;
+		palloc_free_page (pt);
+	}
+
+	enum intr_level old_level = intr_disable ();
+	*pde = vtop (kpage) | PTE_PS | PTE_P | (rw ? PTE_W : 0) | PTE_U;
+	tlb_invalidate (pml4, upage);
+	intr_set_level (old_level);
+	return true;
+}
+
+/* Replaces the 2 MiB mapping of UPAGE in PML4 by a page table of 4 kB
+ * entries that map the same frames with the same permission, accessed
+ * and dirty bits.  Returns false if memory allocation failed, in which
+ * case the large mapping is left in place. */
+bool
+pml4_split_large_page (uint64_t *pml4, void *upage) {
+	uint64_t *pde = pml4e_walk_large (pml4, (uint64_t) upage, LARGE_PGSIZE, 0);
+	ASSERT (pde != NULL && (*pde & PTE_PS));
+
+	uint64_t *pt = palloc_get_page (0);
+	if (pt == NULL)
+		return false;
+
+	uint64_t flags = *pde & PTE_FLAGS & ~(uint64_t) PTE_PS;
+	for (unsigned i = 0; i < PGSIZE / sizeof(uint64_t *); i++)
+		pt[i] = (PTE_ADDR (*pde) + (uint64_t) i * PGSIZE) | flags;
+
+	enum intr_level old_level = intr_disable ();
+	*pde = vtop (pt) | PTE_U | PTE_W | PTE_P;
+	tlb_flush (pml4);
+	intr_set_level (old_level);
+	return true;
+}
+
 /* Marks user virtual page UPAGE "not present" in page
  * directory PD.  Later accesses to the page will fault.  Other
  * bits in the page table entry are preserved.
@@ -256,9 +719,10 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
 	pte = pml4e_walk (pml4, (uint64_t) upage, false);
 
 	if (pte != NULL && (*pte & PTE_P) != 0) {
+		enum intr_level old_level = intr_disable ();
 		*pte &= ~PTE_P;
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) upage);
+		tlb_invalidate (pml4, upage);
+		intr_set_level (old_level);
 	}
 }
 
@@ -268,7 +732,8 @@ pml4_clear_page (uint64_t *pml4, void *upage) {
  * Returns false if PML4 contains no PTE for VPAGE. */
 bool
 pml4_is_dirty (uint64_t *pml4, const void *vpage) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t size;
+	uint64_t *pte = pml4e_lookup (pml4, (uint64_t) vpage, &size);
 	return pte != NULL && (*pte & PTE_D) != 0;
 }
 
@@ -276,15 +741,17 @@ pml4_is_dirty (uint64_t *pml4, const void *vpage) {
  * in PML4. */
 void
 pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t size;
+	uint64_t *pte = pml4e_lookup (pml4, (uint64_t) vpage, &size);
 	if (pte) {
+		enum intr_level old_level = intr_disable ();
 		if (dirty)
 			*pte |= PTE_D;
 		else
 			*pte &= ~(uint32_t) PTE_D;
 
-		if (rcr3 () == vtop (pml4))
-			invlpg ((uint64_t) vpage);
+		tlb_invalidate (pml4, vpage);
+		intr_set_level (old_level);
 	}
 }
 
@@ -294,7 +761,8 @@ pml4_set_dirty (uint64_t *pml4, const void *vpage, bool dirty) {
  * PML4 contains no PTE for VPAGE. */
 bool
 pml4_is_accessed (uint64_t *pml4, const void *vpage) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t size;
+	uint64_t *pte = pml4e_lookup (pml4, (uint64_t) vpage, &size);
 	return pte != NULL && (*pte & PTE_A) != 0;
 }
 
@@ -302,14 +770,36 @@ pml4_is_accessed (uint64_t *pml4, const void *vpage) {
    VPAGE in PD. */
 void
 pml4_set_accessed (uint64_t *pml4, const void *vpage, bool accessed) {
-	uint64_t *pte = pml4e_walk (pml4, (uint64_t) vpage, false);
+	uint64_t size;
+	uint64_t *pte = pml4e_lookup (pml4, (uint64_t) vpage, &size);
 	if (pte) {
 		if (accessed)
 			*pte |= PTE_A;
 		else
 			*pte &= ~(uint32_t) PTE_A;
 
-		if (rcr3 () == vtop (pml4))
+		/* A stale entry only keeps the bit from being set again, so
+		 * an inactive page map is not flushed for it. */
+		if (pml4 == active_pml4)
 			invlpg ((uint64_t) vpage);
 	}
 }
+
+/* Makes the PTE for virtual page VPAGE in PML4 writable or read-only,
+ * keeping the rest of the mapping.  Does nothing if PML4 contains no
+ * PTE for VPAGE. */
+void
+pml4_set_writable (uint64_t *pml4, const void *vpage, bool writable) {
+	uint64_t size;
+	uint64_t *pte = pml4e_lookup (pml4, (uint64_t) vpage, &size);
+	if (pte) {
+		enum intr_level old_level = intr_disable ();
+		if (writable)
+			*pte |= PTE_W;
+		else
+			*pte &= ~(uint64_t) PTE_W;
+
+		tlb_invalidate (pml4, vpage);
+		intr_set_level (old_level);
+	}
+}
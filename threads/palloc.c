@@ -8,6 +8,7 @@
 #include <stdio.h>
 #include <string.h>
 #include "threads/init.h"
+#include "threads/interrupt.h"
 #include "threads/loader.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -31,6 +32,7 @@ struct pool {
 	struct lock lock;               /* Mutual exclusion. */
 	struct bitmap *used_map;        /* Bitmap of free pages. */
 	uint8_t *base;                  /* Base of pool. */
+	size_t free_cnt;                /* Number of free pages. */
 };
 
 /* Two pools: one for kernel data, one for user pages. */
@@ -42,6 +44,7 @@ static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end);
 
 static bool page_from_pool (const struct pool *, void *page);
+static void pool_count (struct pool *, size_t delta);
 
 /* multiboot info */
 struct multiboot_info {
@@ -232,6 +235,11 @@ split:
 			}
 		}
 	}
+
+	kernel_pool.free_cnt = bitmap_count (kernel_pool.used_map, 0,
+			bitmap_size (kernel_pool.used_map), false);
+	user_pool.free_cnt = bitmap_count (user_pool.used_map, 0,
+			bitmap_size (user_pool.used_map), false);
 }
 
 /* Initializes the page allocator and get the memory size */
@@ -265,6 +273,8 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 
 	lock_acquire (&pool->lock);
 	size_t page_idx = bitmap_scan_and_flip (pool->used_map, 0, page_cnt, false);
+	if (page_idx != BITMAP_ERROR)
+		pool_count (pool, -page_cnt);
 	lock_release (&pool->lock);
 	void *pages;
 
@@ -284,6 +294,44 @@ palloc_get_multiple (enum palloc_flags flags, size_t page_cnt) {
 	return pages;
 }
 
+/* Like palloc_get_multiple(), but the returned group of PAGE_CNT
+   pages starts at a physical address that is a multiple of
+   ALIGN_CNT pages.  Used to obtain frames that can be mapped with a
+   single large page-directory entry. */
+void *
+palloc_get_multiple_aligned (enum palloc_flags flags, size_t page_cnt,
+		size_t align_cnt) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	size_t pool_pages = bitmap_size (pool->used_map);
+	size_t page_idx = BITMAP_ERROR;
+	size_t start;
+	void *pages = NULL;
+
+	ASSERT (align_cnt > 0);
+
+	/* First index whose page is aligned. */
+	start = ROUND_UP (pg_no (pool->base), align_cnt) - pg_no (pool->base);
+
+	lock_acquire (&pool->lock);
+	for (; start + page_cnt <= pool_pages; start += align_cnt)
+		if (bitmap_none (pool->used_map, start, page_cnt)) {
+			bitmap_set_multiple (pool->used_map, start, page_cnt, true);
+			pool_count (pool, -page_cnt);
+			page_idx = start;
+			break;
+		}
+	lock_release (&pool->lock);
+
+	if (page_idx != BITMAP_ERROR) {
+		pages = pool->base + PGSIZE * page_idx;
+		if (flags & PAL_ZERO)
+			memset (pages, 0, PGSIZE * page_cnt);
+	} else if (flags & PAL_ASSERT)
+		PANIC ("palloc_get: out of pages");
+
+	return pages;
+}
+
 /* Obtains a single free page and returns its kernel virtual
    address.
    If PAL_USER is set, the page is obtained from the user pool,
@@ -320,6 +368,7 @@ palloc_free_multiple (void *pages, size_t page_cnt) {
 #endif
 	ASSERT (bitmap_all (pool->used_map, page_idx, page_cnt));
 	bitmap_set_multiple (pool->used_map, page_idx, page_cnt, false);
+	pool_count (pool, page_cnt);
 }
 
 /* Frees the page at PAGE. */
@@ -328,6 +377,32 @@ palloc_free_page (void *page) {
 	palloc_free_multiple (page, 1);
 }
 
+/* Returns the number of free pages in the user pool (if PAL_USER is
+   set in FLAGS) or the kernel pool.  The count is only a snapshot. */
+size_t
+palloc_free_cnt (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return pool->free_cnt;
+}
+
+/* Returns the number of pages in the user pool (if PAL_USER is set
+   in FLAGS) or the kernel pool. */
+size_t
+palloc_page_cnt (enum palloc_flags flags) {
+	struct pool *pool = flags & PAL_USER ? &user_pool : &kernel_pool;
+	return bitmap_size (pool->used_map);
+}
+
+/* Adds DELTA to the free page count of POOL.  Pages are freed
+   without holding the pool lock, sometimes with interrupts off, so
+   the count is updated with interrupts disabled instead. */
+static void
+pool_count (struct pool *pool, size_t delta) {
+	enum intr_level old_level = intr_disable ();
+	pool->free_cnt += delta;
+	intr_set_level (old_level);
+}
+
 /* Initializes pool P as starting at START and ending at END */
 static void
 init_pool (struct pool *p, void **bm_base, uint64_t start, uint64_t end) {
@@ -21,6 +21,7 @@
 #include "intrinsic.h"
 #ifdef VM
 #include "vm/vm.h"
+#include "vm/memcg.h"
 #endif
 
 #define WORD 8
@@ -110,47 +111,11 @@ process_fork (const char *name, struct intr_frame *if_) {
 	return tid;
 }
 
-#ifndef VM
-/* Duplicate the parent's address space by passing this function to the
- * pml4_for_each. This is only for the project 2. */
-static bool
-duplicate_pte (uint64_t *pte, void *va, void *aux) {
-	struct thread *current = thread_current ();
-	struct thread *parent = (struct thread *) aux;
-	void *parent_page;
-	void *newpage;
-	bool writable;
-
-	/* 1. TODO: If the va is kernel page, then return immediately. */
-	if (is_kernel_vaddr(va)) {
-		return true;
-	}
-
-	/* 2. Resolve VA from the parent's page map level 4. */
-	parent_page = pml4_get_page (parent->pml4, va);
-
-	/* 3. TODO: Allocate new PAL_USER page for the child and set result to
-	 *    TODO: NEWPAGE. */
-	newpage = palloc_get_page(PAL_USER);
-
-	/* 4. TODO: Duplicate parent's page to the new page and
-	 *    TODO: check whether parent's page is writable or not (set WRITABLE
-	 *    TODO: according to the result). */
-	memcpy(newpage, parent_page, PGSIZE);
-
-	/* 5. Add new page to child's page table at address VA with WRITABLE
-	 *    permission. */
-	
-	/* Check whether parent page table entry is writable */
-	writable = is_writable(pte);
-	if (!pml4_set_page (current->pml4, va, newpage, writable)) {
-		// FIXME: do error handling what?
-		return false;
-		/* 6. TODO: if fail to insert page, do error handling. */
-	}
-	return true;
-}
-#endif
+/* Address space statistics. */
+static size_t copy_cnt;          /* Address spaces copied by fork. */
+static uint64_t copy_cycles;     /* TSC cycles spent copying them. */
+static size_t teardown_cnt;      /* Address spaces torn down. */
+static uint64_t teardown_cycles; /* TSC cycles spent tearing them down. */
 
 /* A thread function that copies parent's execution context.
  * Hint) parent->tf does not hold the userland context of the process.
@@ -185,14 +150,22 @@ __do_fork (void *f) {
 		goto error;
 
 	process_activate (current);
+	uint64_t copy_start = rdtsc ();
 #ifdef VM
+	/* The child is in the memory control group of its parent, and so
+	 * are the frames it gets from here on. */
+	memcg_attach (current, parent->memcg);
 	supplemental_page_table_init (&current->spt);
 	if (!supplemental_page_table_copy (&current->spt, &parent->spt))
 		goto error;
 #else
-	if (!pml4_for_each (parent->pml4, duplicate_pte, parent))
+	/* Copy the user half run by run, skipping what is not mapped. */
+	if (!pml4_copy_range (current->pml4, parent->pml4, NULL,
+				(void *) KERN_BASE))
 		goto error;
 #endif
+	copy_cycles += rdtsc () - copy_start;
+	copy_cnt++;
 	process_init ();
 	
 	if (!list_empty(&parent->file_descriptors)) {
@@ -255,6 +228,10 @@ process_exec (void *f_name) {
 
 	/* We first kill the current context */
 	process_cleanup ();
+#ifdef VM
+	/* process_cleanup destroyed the SPT, so start a fresh one. */
+	supplemental_page_table_init (&thread_current ()->spt);
+#endif
 
 	lock_acquire(&access_filesys);
 	/* And then load the binary */
@@ -359,12 +336,16 @@ process_exit (void) {
 	
 	/* Parent received my status. Now I can exit my self. */
 	process_cleanup ();
+#ifdef VM
+	memcg_detach (curr);
+#endif
 }
 
 /* Free the current process's resources. */
 static void
 process_cleanup (void) {
 	struct thread *curr = thread_current ();
+	uint64_t start = rdtsc ();
 
 #ifdef VM
 	supplemental_page_table_kill (&curr->spt);
@@ -385,9 +366,21 @@ process_cleanup (void) {
 		curr->pml4 = NULL;
 		pml4_activate (NULL);
 		pml4_destroy (pml4);
+		teardown_cycles += rdtsc () - start;
+		teardown_cnt++;
 	}
 }
 
+/* Prints address space statistics. */
+void
+process_print_stats (void) {
+	printf ("Process: %zu address spaces copied, %llu cycles each; "
+			"%zu torn down, %llu cycles each\n", copy_cnt,
+			copy_cnt > 0 ? (unsigned long long) (copy_cycles / copy_cnt) : 0,
+			teardown_cnt, teardown_cnt > 0
+			? (unsigned long long) (teardown_cycles / teardown_cnt) : 0);
+}
+
 /* Sets up the CPU for running user code in the nest thread.
  * This function is called on every context switch. */
 void
@@ -780,37 +773,37 @@ install_page (void *upage, void *kpage, bool writable) {
  * upper block. */
 
 bool
-lazy_load_segment (struct page *page, void *aux) {
+lazy_load_segment (struct page *page, void *aux UNUSED) {
 	/* TODO: Load the segment from the file */
 	/* TODO: This called when the first page fault occurs on address VA. */
 	/* TODO: VA is available when calling this function. */
 	
-	// needed: file, ofs, read_bytes, zero_bytes(derived from read_bytes)
-	// Copy of bare load_segment, cause they need same behavior.
-	struct args_for_lazy_load_segment *_aux = (struct args_for_lazy_load_segment*)aux;
+	// The page's area tells which part of which file the page maps.
+	struct vm_area *area = page->area;
+	size_t page_read_bytes = vm_area_page_read_bytes(area, page->va);
 	
-	file_seek(_aux->file, _aux->ofs);
-
 	if (page->frame->kva == NULL) {
 		return false;
 	}
+	
+	if (page_read_bytes > 0) {
+		off_t ofs = vm_area_page_offset(area, page->va);
+		int result = file_read_at(area->file, page->frame->kva, page_read_bytes, ofs);
 		
-	int result = file_read(_aux->file, page->frame->kva, _aux->page_read_bytes);	
+		thread_current()->fault_io = true;
 		
-	if (result != (int) _aux->page_read_bytes) {
-		palloc_free_page (page->frame->kva);
-		return false;
+		if (result != (int) page_read_bytes) {
+			return false;
+		}
 	}
 	
-	size_t page_zero_bytes = PGSIZE - _aux->page_read_bytes;
+	size_t page_zero_bytes = PGSIZE - page_read_bytes;
 	
-	memset(page->frame->kva + _aux->page_read_bytes, 0, page_zero_bytes);
+	memset(page->frame->kva + page_read_bytes, 0, page_zero_bytes);
 	
 	// Why don't we need installing the page? cause it is already installed by swap in.
 	// More precisely, vm_claim_page from vm_try_handle_fault called by page_fault exception handler.
 	
-	file_seek(_aux->file, _aux->ofs);
-	
 	return true;
 }
 
@@ -836,32 +829,23 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 	ASSERT (pg_ofs (upage) == 0);
 	ASSERT (ofs % PGSIZE == 0);
 
-	file_seek(file, ofs);
-	while (read_bytes > 0 || zero_bytes > 0) {
-		/* Do calculate how to fill this page.
-		 * We will read PAGE_READ_BYTES bytes from FILE
-		 * and zero the final PAGE_ZERO_BYTES bytes. */
-		size_t page_read_bytes = read_bytes < PGSIZE ? read_bytes : PGSIZE;
-		size_t page_zero_bytes = PGSIZE - page_read_bytes;
-
-		/* TODO: Set up aux to pass information to the lazy_load_segment. */
-		struct args_for_lazy_load_segment *aux = malloc(sizeof(struct args_for_lazy_load_segment));
-		aux->ofs = ofs;
-		aux->page_read_bytes = page_read_bytes;
-		aux->file = file;
-		
-
-		if (!vm_alloc_page_with_initializer (VM_ANON, upage, writable, lazy_load_segment, aux)) {
-			free(aux);
-			return false;
-		}
-
-		/* Advance. */
-		read_bytes -= page_read_bytes;
-		zero_bytes -= page_zero_bytes;
-		upage += PGSIZE;
-		ofs += page_read_bytes;
+	/* The whole segment becomes one area. Its pages are created and
+	 * read by lazy_load_segment on their first fault. The area keeps
+	 * its own handle of FILE, which may be closed before the process
+	 * exits. */
+	struct file *area_file = NULL;
+	
+	if (read_bytes > 0 && (area_file = file_reopen(file)) == NULL) {
+		return false;
+	}
+	
+	if (vm_area_create(&thread_current()->spt, upage, read_bytes + zero_bytes,
+				VM_ANON, writable, area_file, ofs, read_bytes) == NULL) {
+		if (area_file != NULL)
+			file_close(area_file);
+		return false;
 	}
+	
 	return true;
 }
 
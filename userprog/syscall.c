@@ -1,6 +1,7 @@
 #include "userprog/syscall.h"
 #include <stdio.h>
 #include <syscall-nr.h>
+#include <syscall-vm.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
 #include "threads/loader.h"
@@ -12,6 +13,7 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "vm/vm.h"
+#include "vm/memcg.h"
 
 void syscall_entry (void);
 void syscall_handler (struct intr_frame *);
@@ -56,13 +58,42 @@ static void user_memory_bound_check(void *address) {
 		exit(-1);
 	}
 
-	if (spt_find_page(&curr->spt, address) == NULL) {
+	if (spt_find_page(&curr->spt, address) == NULL
+			&& vm_area_find(&curr->spt, address) == NULL) {
 		exit(-1);
 	}
 	
 	return;
 }
 
+/* The kernel writes to [BUFFER, BUFFER + SIZE) on behalf of the process,
+ * so every page of it must be one the process itself may write: a
+ * read-only page, such as code shared with other processes, kills it. */
+static void user_memory_writable_check(void *buffer, size_t size) {
+	struct thread *curr = thread_current();
+	uint8_t *end = (uint8_t *) buffer + size;
+	uint8_t *va;
+	
+	user_memory_bound_check(buffer);
+	
+	if (end < (uint8_t *) buffer) {
+		exit(-1);
+	}
+	
+	for (va = pg_round_down(buffer); va < end; va += PGSIZE) {
+		struct page *page = spt_find_page(&curr->spt, va);
+		struct vm_area *area = vm_area_find(&curr->spt, va);
+		
+		if (!is_user_vaddr(va)) {
+			exit(-1);
+		}
+		
+		if (page != NULL ? !page->is_writable : area == NULL || !area->writable) {
+			exit(-1);
+		}
+	}
+}
+
 static void halt(void) {
 	power_off();
 }
@@ -71,6 +102,11 @@ void exit(int status) {
 	struct thread *curr = thread_current();
 	curr->exit_code = status;
 	printf("%s: exit(%d)\n", curr->name, status); 
+	
+	if (vm_exit_stats) {
+		vm_print_exit_stats();
+	}
+	
 	/* This will call process_exit */
 	thread_exit();
 }
@@ -182,7 +218,7 @@ static int filesize(int fd) {
 }
 
 static int read (int fd, void *buffer, unsigned size) {
-	user_memory_bound_check(buffer);
+	user_memory_writable_check(buffer, size);
 	
 	struct file_with_descriptor *f = fd_to_file_with_descriptor(fd);
 	
@@ -267,9 +303,16 @@ static void* mmap(void *addr, size_t length, int writable, int fd, off_t offset)
 		return NULL;
 	}
 	
+	/* The stack may grow down to STACK_LIMIT, and a guard gap below
+	 * that keeps mappings from running into it. */
+	if ((uint8_t *) addr < (uint8_t *) USER_STACK
+			&& (uint8_t *) addr + length > STACK_LIMIT - STACK_GUARD_GAP) {
+		return NULL;
+	}
+	
 	/* Should not be already allocated address */
 	struct thread *t = thread_current();
-	if (spt_find_page(&t->spt, addr)) {
+	if (spt_find_page(&t->spt, addr) || vm_area_overlaps(&t->spt, addr, length)) {
 		return NULL;
 	}
 	
@@ -283,6 +326,34 @@ static void* mmap(void *addr, size_t length, int writable, int fd, off_t offset)
 	return do_mmap(addr, length, writable, f->_file, offset);
 }
 
+static int vmstat(struct vmstat *stat) {
+	struct vmstat result;
+	
+	user_memory_writable_check(stat, sizeof *stat);
+	
+	/* vm_stat() holds the frame lock, so copy out only afterwards: the
+	 * copy may fault. */
+	vm_stat(&result);
+	*stat = result;
+	
+	return 0;
+}
+
+static int memcg_create(size_t soft_limit, size_t hard_limit) {
+	return memcg_enter_new(soft_limit, hard_limit);
+}
+
+static int memcg_stat(struct memcg_stat *stat) {
+	struct memcg_stat result;
+	
+	user_memory_writable_check(stat, sizeof *stat);
+	
+	memcg_get_stat(memcg_of(thread_current()), &result);
+	*stat = result;
+	
+	return 0;
+}
+
 void
 syscall_init (void) {
 	write_msr(MSR_STAR, ((uint64_t)SEL_UCSEG - 0x10) << 48  |
@@ -305,6 +376,7 @@ syscall_init (void) {
 void
 syscall_handler (struct intr_frame *f UNUSED) {
 	thread_current()->current_rsp = f->rsp;
+	vm_ws_sample();
 	
 	switch (f->R.rax) {
 		case SYS_HALT:
@@ -355,5 +427,20 @@ syscall_handler (struct intr_frame *f UNUSED) {
 		case SYS_MUNMAP:
 			do_munmap(f->R.rdi);
 			break;
+		case SYS_MSYNC:
+			f->R.rax = do_msync((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+			break;
+		case SYS_MADVISE:
+			f->R.rax = do_madvise((void *) f->R.rdi, f->R.rsi, f->R.rdx);
+			break;
+		case SYS_VMSTAT:
+			f->R.rax = vmstat((void *) f->R.rdi);
+			break;
+		case SYS_MEMCG_CREATE:
+			f->R.rax = memcg_create(f->R.rdi, f->R.rsi);
+			break;
+		case SYS_MEMCG_STAT:
+			f->R.rax = memcg_stat((void *) f->R.rdi);
+			break;
 	}
 }
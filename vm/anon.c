@@ -2,6 +2,15 @@
 
 #include "vm/vm.h"
 #include "devices/disk.h"
+#include <bitmap.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "vm/zswap.h"
 
 /* DO NOT MODIFY BELOW LINE */
 static struct disk *swap_disk;
@@ -17,11 +26,47 @@ static const struct page_operations anon_ops = {
 	.type = VM_ANON,
 };
 
+/* The swap disk is divided into slots of one page each.  A page that
+ * leaves memory takes a free slot and gives it back when it is read
+ * in again or destroyed.  Pages that shared a frame copy-on-write
+ * also share its slot, which is counted and freed with its last page.
+ * Pages evicted together are written to a run
+ * of consecutive slots with one disk command, in address order, so that
+ * a later fault on the first of them can read the others back with
+ * the same command.  Pages that compress well are kept in the zswap
+ * pool instead, and reach their slots on the disk only if the pool
+ * fills up. */
+
+/* Number of disk sectors in a swap slot. */
+#define SLOT_SECTORS (PGSIZE / DISK_SECTOR_SIZE)
+
+static struct bitmap *swap_slots;  /* Slots in use, NULL without a swap disk. */
+static uint16_t *slot_refs;        /* Number of pages using each slot. */
+static struct lock swap_lock;      /* Protects the slots and the counters. */
+
+/* Swap statistics. */
+static size_t swap_out_cnt;     /* Pages written to swap. */
+static size_t swap_write_cnt;   /* Disk commands that wrote them. */
+static size_t swap_in_cnt;      /* Pages read from swap. */
+static size_t swap_read_cnt;    /* Disk commands that read them. */
+static size_t readahead_cnt;    /* Pages read before they were touched. */
+
 /* Initialize the data for anonymous pages */
 void
 vm_anon_init (void) {
-	/* TODO: Set up the swap_disk. */
-	swap_disk = NULL;
+	swap_disk = disk_get (1, 1);
+	lock_init (&swap_lock);
+	if (swap_disk != NULL) {
+		size_t slot_cnt = disk_size (swap_disk) / SLOT_SECTORS;
+
+		swap_slots = bitmap_create (slot_cnt);
+		slot_refs = calloc (slot_cnt, sizeof *slot_refs);
+		if (swap_slots == NULL || slot_refs == NULL)
+			PANIC ("Cannot allocate the swap slot table");
+
+		/* Compressed pages may take up a quarter of the kernel pool. */
+		zswap_init (palloc_page_cnt (0) / 4 * PGSIZE);
+	}
 }
 
 /* Initialize the file mapping */
@@ -31,23 +76,264 @@ anon_initializer (struct page *page, enum vm_type type, void *kva) {
 	page->operations = &anon_ops;
 
 	struct anon_page *anon_page = &page->anon;
+	anon_page->slot = SWAP_SLOT_NONE;
+
+	/* A fresh anonymous page reads as zeros. */
+	memset (kva, 0, PGSIZE);
+	return true;
+}
+
+/* Make PAGE, an uninitialized anonymous page with nothing to load, an
+ * anonymous page that has neither a frame nor a swap slot yet.  Used
+ * for pages that map the zero frame. */
+void
+anon_init_zero (struct page *page) {
+	ASSERT (page->uninit.init == NULL && page->uninit.aux == NULL);
+
+	page->operations = &anon_ops;
+	page->anon.slot = SWAP_SLOT_NONE;
 }
 
-/* Swap in the page by read contents from the swap disk. */
+/* Transfers the CNT pages at KVAS to (if WRITE) or from the CNT
+ * consecutive swap slots starting at SLOT, with a single disk command. */
+static void
+swap_transfer (size_t slot, void *const kvas[], size_t cnt, bool write) {
+	void *sectors[SWAP_CLUSTER_MAX * SLOT_SECTORS];
+	size_t i;
+
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER_MAX);
+
+	for (i = 0; i < cnt * SLOT_SECTORS; i++)
+		sectors[i] = (uint8_t *) kvas[i / SLOT_SECTORS]
+			+ i % SLOT_SECTORS * DISK_SECTOR_SIZE;
+
+	if (write)
+		disk_write_sectors (swap_disk, slot * SLOT_SECTORS,
+				(const void *const *) sectors, cnt * SLOT_SECTORS);
+	else
+		disk_read_sectors (swap_disk, slot * SLOT_SECTORS,
+				sectors, cnt * SLOT_SECTORS);
+}
+
+/* Writes the page at KVA to swap slot SLOT on the disk.  Used by zswap
+ * to make room in its pool. */
+void
+anon_swap_write_slot (size_t slot, const void *kva) {
+	void *kvas[1] = { (void *) kva };
+
+	swap_transfer (slot, kvas, 1, true);
+}
+
+/* Drop the reference of PAGE to its swap slot, freeing the slot if
+ * no other page uses it.  Caller must hold swap_lock. */
+static void
+swap_slot_put (struct page *page) {
+	size_t slot = page->anon.slot;
+
+	ASSERT (slot_refs[slot] > 0);
+	if (--slot_refs[slot] == 0) {
+		zswap_invalidate (slot);
+		bitmap_reset (swap_slots, slot);
+	}
+	page->anon.slot = SWAP_SLOT_NONE;
+}
+
+/* Give back the swap slot of PAGE. */
+static void
+swap_slot_free (struct page *page) {
+	lock_acquire (&swap_lock);
+	swap_slot_put (page);
+	lock_release (&swap_lock);
+}
+
+/* Swap in the page by read contents from the swap disk.
+ * The pages that followed PAGE when it was swapped out sit in the next
+ * slots and are likely to be touched soon, so they are read with the
+ * same command into free frames, if there are any. */
 static bool
 anon_swap_in (struct page *page, void *kva) {
 	struct anon_page *anon_page = &page->anon;
+	struct page *pages[SWAP_CLUSTER_MAX];
+	void *kvas[SWAP_CLUSTER_MAX];
+	size_t cnt = 1, i;
+
+	if (anon_page->slot == SWAP_SLOT_NONE)
+		return false;
+
+	/* A compressed page costs no disk read. */
+	if (zswap_load (anon_page->slot, kva)) {
+		thread_current ()->vmstat.swap_ins++;
+		lock_acquire (&swap_lock);
+		swap_slot_put (page);
+		swap_in_cnt++;
+		lock_release (&swap_lock);
+		return true;
+	}
+
+	pages[0] = page;
+	kvas[0] = kva;
+
+	/* Only the faulting process may look into its own page table. */
+	if (page->owner == thread_current ())
+		while (cnt < SWAP_CLUSTER_MAX) {
+			struct page *next = spt_find_page (&page->owner->spt,
+					(uint8_t *) page->va + cnt * PGSIZE);
+
+			if (next == NULL || next->operations != &anon_ops
+					|| next->frame != NULL
+					|| next->anon.slot != anon_page->slot + cnt
+					|| zswap_contains (next->anon.slot)
+					|| (kvas[cnt] = vm_frame_prefetch (next)) == NULL)
+				break;
+			pages[cnt++] = next;
+		}
+
+	swap_transfer (anon_page->slot, kvas, cnt, false);
+	thread_current ()->fault_io = true;
+	thread_current ()->vmstat.swap_ins += cnt;
+
+	lock_acquire (&swap_lock);
+	for (i = 0; i < cnt; i++)
+		swap_slot_put (pages[i]);
+	swap_in_cnt += cnt;
+	swap_read_cnt++;
+	readahead_cnt += cnt - 1;
+	lock_release (&swap_lock);
+
+	for (i = 1; i < cnt; i++)
+		vm_frame_unpin (pages[i]);
+	return true;
 }
 
 /* Swap out the page by writing contents to the swap disk. */
 static bool
 anon_swap_out (struct page *page) {
-	struct anon_page *anon_page = &page->anon;
+	return anon_swap_out_cluster (&page, 1);
+}
+
+/* Write the CNT resident anonymous pages in PAGES, which are consecutive
+ * pages of one process in address order, to swap.  The pages that
+ * compress well go to the zswap pool, each run of the others to the
+ * disk with one command.  If no run of CNT free slots is left, the
+ * pages are swapped out one by one instead.  Returns false if swap is
+ * full, leaving no page in swap. */
+bool
+anon_swap_out_cluster (struct page *pages[], size_t cnt) {
+	void *kvas[SWAP_CLUSTER_MAX];
+	size_t slot, i, run, disk_cnt = 0, write_cnt = 0;
+
+	ASSERT (cnt > 0 && cnt <= SWAP_CLUSTER_MAX);
+
+	if (swap_slots == NULL)
+		return false;
+
+	lock_acquire (&swap_lock);
+	slot = bitmap_scan_and_flip (swap_slots, 0, cnt, false);
+	for (i = 0; slot != BITMAP_ERROR && i < cnt; i++)
+		slot_refs[slot + i] = 1;
+	lock_release (&swap_lock);
+
+	if (slot == BITMAP_ERROR) {
+		if (cnt == 1)
+			return false;
+		for (i = 0; i < cnt; i++)
+			if (!anon_swap_out_cluster (&pages[i], 1)) {
+				while (i-- > 0)
+					swap_slot_free (pages[i]);
+				return false;
+			}
+		return true;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		kvas[i] = pages[i]->frame->kva;
+		pages[i]->anon.slot = slot + i;
+	}
+	for (i = 0; i < cnt; i += run + 1) {
+		for (run = 0; i + run < cnt
+				&& !zswap_store (slot + i + run, kvas[i + run]); run++)
+			continue;
+		if (run > 0) {
+			swap_transfer (slot + i, &kvas[i], run, true);
+			disk_cnt += run;
+			write_cnt++;
+		}
+	}
+
+	lock_acquire (&swap_lock);
+	swap_out_cnt += disk_cnt;
+	swap_write_cnt += write_cnt;
+	lock_release (&swap_lock);
+	return true;
+}
+
+/* Make DST, which may still be uninitialized, an anonymous page with
+ * the contents of SRC: both then use the same frame or swap slot,
+ * whichever SRC has.  The caller links DST to the frame. */
+void
+anon_share (struct page *dst, struct page *src) {
+	dst->operations = &anon_ops;
+	dst->anon.slot = src->anon.slot;
+
+	if (dst->anon.slot != SWAP_SLOT_NONE) {
+		lock_acquire (&swap_lock);
+		ASSERT (slot_refs[dst->anon.slot] < UINT16_MAX);
+		slot_refs[dst->anon.slot]++;
+		lock_release (&swap_lock);
+	}
 }
 
 /* Destroy the anonymous page. PAGE will be freed by the caller. */
 static void
 anon_destroy (struct page *page) {
-	// struct anon_page *anon_page = &page->anon;
-	return;
+	struct anon_page *anon_page = &page->anon;
+	uint64_t *pml4 = page->owner->pml4;
+
+	/* A mapped frame is released by pml4_destroy, unless another page
+	 * still shares it.  A frame filled ahead of the fault, by readahead
+	 * or from the text cache, was never mapped, so free it here.  Detach
+	 * first: the page may be swapped out by another thread until then. */
+	if (page->frame != NULL) {
+		void *kva = vm_frame_detach (page);
+
+		if (kva == NULL) {
+			if (pml4 != NULL)
+				pml4_clear_page (pml4, page->va);
+		} else if (pml4 == NULL || pml4_get_page (pml4, page->va) == NULL)
+			palloc_free_page (kva);
+	}
+
+	if (anon_page->slot != SWAP_SLOT_NONE)
+		swap_slot_free (page);
+}
+
+/* Prints swap statistics: the traffic, and how the free slots are
+ * scattered over the swap disk. */
+void
+anon_print_stats (void) {
+	size_t slot_cnt, used, runs = 0, largest = 0, run = 0, i;
+
+	if (swap_slots == NULL)
+		return;
+
+	slot_cnt = bitmap_size (swap_slots);
+	used = bitmap_count (swap_slots, 0, slot_cnt, true);
+	for (i = 0; i < slot_cnt; i++) {
+		if (bitmap_test (swap_slots, i)) {
+			run = 0;
+			continue;
+		}
+		if (run++ == 0)
+			runs++;
+		if (run > largest)
+			largest = run;
+	}
+
+	printf ("Swap: %zu pages out in %zu writes, "
+			"%zu pages in in %zu reads (%zu read ahead)\n",
+			swap_out_cnt, swap_write_cnt, swap_in_cnt, swap_read_cnt,
+			readahead_cnt);
+	printf ("Swap: %zu of %zu slots used, free slots in %zu runs "
+			"(largest %zu)\n", used, slot_cnt, runs, largest);
+	zswap_print_stats ();
 }
@@ -0,0 +1,205 @@
+/* area.c: Virtual memory areas.
+ *
+ * Each process keeps its areas in a list sorted by start address.
+ * Areas never overlap, so the area that holds an address is the last
+ * one starting at or below it.  A process has only a handful of areas
+ * (its ELF segments and mmaps), so walking the list is cheap, and the
+ * most recently found area is cached for runs of faults in the same
+ * area. */
+
+#include "vm/area.h"
+#include "vm/vm.h"
+#include "threads/malloc.h"
+#include "threads/mmu.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+#include "filesys/file.h"
+#include "userprog/process.h"
+#include <syscall-vm.h>
+
+/* Create an area of LENGTH bytes (rounded up to whole pages) at START
+ * and insert it into SPT.  The first READ_BYTES bytes come from FILE at
+ * offset OFS, the rest is zero-filled.  The area takes over FILE and
+ * closes it when it is destroyed.  Returns NULL if the range overlaps
+ * another area or on allocation failure. */
+struct vm_area *
+vm_area_create (struct supplemental_page_table *spt, void *start,
+		size_t length, enum vm_type type, bool writable,
+		struct file *file, off_t ofs, size_t read_bytes) {
+	ASSERT (pg_ofs (start) == 0);
+	ASSERT (VM_TYPE (type) == VM_ANON || VM_TYPE (type) == VM_FILE);
+
+	length = (size_t) pg_round_up (length);
+	if (length == 0 || !is_user_vaddr ((uint8_t *) start + length - 1)
+			|| vm_area_overlaps (spt, start, length))
+		return NULL;
+
+	struct vm_area *area = malloc (sizeof (struct vm_area));
+	if (area == NULL)
+		return NULL;
+
+	area->start = start;
+	area->end = (uint8_t *) start + length;
+	area->type = type;
+	area->writable = writable;
+	area->file = file;
+	area->ofs = ofs;
+	area->read_bytes = read_bytes;
+	list_init (&area->pages);
+	area->ra_prev = area->ra_start = area->ra_next = NULL;
+	area->ra_pages = 0;
+	area->advice = MADV_NORMAL;
+
+	struct list_elem *e;
+	for (e = list_begin (&spt->areas); e != list_end (&spt->areas);
+			e = list_next (e))
+		if (list_entry (e, struct vm_area, elem)->start > start)
+			break;
+	list_insert (e, &area->elem);
+
+	return area;
+}
+
+/* Remove AREA from SPT, destroying the pages faulted in so far and
+ * closing its file.  The dirty pages of a file mapping are written back
+ * first, in file order and in large writes, so that destroying them
+ * one by one writes nothing.  Their TLB entries are dropped together
+ * at the end. */
+void
+vm_area_destroy (struct supplemental_page_table *spt, struct vm_area *area) {
+	struct tlb_batch batch;
+
+	if (area->type == VM_FILE)
+		file_writeback (area, area->start, area->end);
+
+	tlb_batch_begin (&batch);
+	while (!list_empty (&area->pages)) {
+		struct page *page = list_entry (list_front (&area->pages),
+				struct page, area_elem);
+		spt_remove_page (spt, page);
+	}
+	tlb_batch_end (&batch);
+
+	if (spt->area_cache == area)
+		spt->area_cache = NULL;
+	list_remove (&area->elem);
+	if (area->file != NULL)
+		file_close (area->file);
+	free (area);
+}
+
+/* Find the area of SPT that contains VA. On error, return NULL. */
+struct vm_area *
+vm_area_find (struct supplemental_page_table *spt, const void *va) {
+	struct vm_area *area = spt->area_cache;
+	struct list_elem *e;
+
+	if (area != NULL && area->start <= va && va < area->end)
+		return area;
+
+	for (e = list_begin (&spt->areas); e != list_end (&spt->areas);
+			e = list_next (e)) {
+		area = list_entry (e, struct vm_area, elem);
+		if (va < area->start)
+			break;
+		if (va < area->end) {
+			spt->area_cache = area;
+			return area;
+		}
+	}
+	return NULL;
+}
+
+/* Returns true if [START, START + LENGTH) intersects an area of SPT. */
+bool
+vm_area_overlaps (struct supplemental_page_table *spt, const void *start,
+		size_t length) {
+	const uint8_t *end = (const uint8_t *) start + length;
+	struct list_elem *e;
+
+	for (e = list_begin (&spt->areas); e != list_end (&spt->areas);
+			e = list_next (e)) {
+		struct vm_area *area = list_entry (e, struct vm_area, elem);
+		if ((const void *) end <= area->start)
+			break;
+		if (start < area->end)
+			return true;
+	}
+	return false;
+}
+
+/* Number of bytes of the page at VA in AREA that come from its file. */
+size_t
+vm_area_page_read_bytes (const struct vm_area *area, const void *va) {
+	size_t done = (const uint8_t *) va - (const uint8_t *) area->start;
+
+	if (done >= area->read_bytes)
+		return 0;
+	return area->read_bytes - done < PGSIZE ? area->read_bytes - done : PGSIZE;
+}
+
+/* File offset of the page at VA in AREA. */
+off_t
+vm_area_page_offset (const struct vm_area *area, const void *va) {
+	return area->ofs + ((const uint8_t *) va - (const uint8_t *) area->start);
+}
+
+/* Create the struct page for VA inside AREA in the current process.
+ * If LOAD is true, the page is filled from the area by
+ * lazy_load_segment when it is claimed; otherwise its contents are left
+ * for the caller.  Returns the new page, or NULL on failure. */
+struct page *
+vm_area_alloc_page (struct vm_area *area, void *va, bool load) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct page *page;
+
+	va = pg_round_down (va);
+	ASSERT (area->start <= va && va < area->end);
+
+	if (!vm_alloc_page_with_initializer (area->type, va, area->writable,
+				load ? lazy_load_segment : NULL, NULL))
+		return NULL;
+
+	page = spt_find_page (spt, va);
+	page->area = area;
+	list_push_back (&area->pages, &page->area_elem);
+	return page;
+}
+
+/* Copy the areas of SRC into DST, which belongs to the current process.
+ * Pages are not copied. */
+bool
+vm_area_copy (struct supplemental_page_table *dst,
+		struct supplemental_page_table *src) {
+	struct list_elem *e;
+
+	for (e = list_begin (&src->areas); e != list_end (&src->areas);
+			e = list_next (e)) {
+		struct vm_area *area = list_entry (e, struct vm_area, elem);
+		struct file *file = NULL;
+
+		if (area->file != NULL && (file = file_reopen (area->file)) == NULL)
+			return false;
+
+		struct vm_area *copy = vm_area_create (dst, area->start,
+				(uint8_t *) area->end - (uint8_t *) area->start,
+				area->type, area->writable, file, area->ofs,
+				area->read_bytes);
+
+		if (copy == NULL) {
+			if (file != NULL)
+				file_close (file);
+			return false;
+		}
+		copy->advice = area->advice;
+	}
+	return true;
+}
+
+/* Destroy every area of SPT. */
+void
+vm_area_kill (struct supplemental_page_table *spt) {
+	while (!list_empty (&spt->areas))
+		vm_area_destroy (spt, list_entry (list_front (&spt->areas),
+					struct vm_area, elem));
+}
@@ -1,10 +1,16 @@
 /* file.c: Implementation of memory backed file object (mmaped object). */
 
 #include "vm/vm.h"
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
+#include <syscall-vm.h>
 #include "threads/vaddr.h"
 #include "threads/mmu.h"
+#include "threads/malloc.h"
 #include "userprog/process.h"
 #include "filesys/file.h"
+#include "intrinsic.h"
 
 static bool file_backed_swap_in (struct page *page, void *kva);
 static bool file_backed_swap_out (struct page *page);
@@ -18,6 +24,10 @@ static const struct page_operations file_ops = {
 	.type = VM_FILE,
 };
 
+/* Munmap statistics. */
+static size_t munmap_cnt;           /* Mappings removed by munmap. */
+static uint64_t munmap_cycles;      /* TSC cycles spent removing them. */
+
 /* The initializer of file vm */
 void
 vm_file_init (void) {
@@ -29,41 +39,60 @@ file_backed_initializer (struct page *page, enum vm_type type, void *kva) {
 	/* Set up the handler */
 	page->operations = &file_ops;
 	struct file_page *file_page = &page->file;
+	return true;
 }
 
 /* Swap in the page by read contents from the file. */
 static bool
 file_backed_swap_in (struct page *page, void *kva) {
 	struct file_page *file_page UNUSED = &page->file;
+
+	/* Same as the first fault: read the page back from its area. */
+	return lazy_load_segment (page, NULL);
 }
 
-/* Swap out the page by writeback contents to the file. */
+/* Swap out the page.  A page holding file data maps a frame of the page
+ * cache, which writes it back itself, so only a page wholly past the
+ * end of the file has a frame of its own.  It has nothing to write
+ * back, and reads as zeros again like a page never touched: drop it.
+ * The caller holds frame_lock, under which the file system must not be
+ * entered. */
 static bool
 file_backed_swap_out (struct page *page) {
-	struct file_page *file_page UNUSED = &page->file;
+	ASSERT (vm_area_page_read_bytes (page->area, page->va) == 0);
+	return true;
 }
 
 /* Destory the file backed page. PAGE will be freed by the caller. */
 static void
 file_backed_destroy (struct page *page) {
-	//if dirty, write back to file
-	struct args_for_lazy_load_segment* aux = page->uninit.aux;
-	struct thread *t = thread_current();
-
-	// printf("dirty\n");
-	if (pml4_is_dirty (t->pml4, page->va)){
-		// printf("file length %d, ofs %d, read bytes %d\n", file_length(aux->file), aux->ofs, aux->page_read_bytes);
-		file_seek (aux->file, aux->ofs);
-		int result = file_write (aux->file, page->va, aux->page_read_bytes);
-		// printf("write bytes %d\n", result);
-	}
+	uint64_t *pml4 = page->owner->pml4;
+
+	/* Once detached, the page can no longer be evicted under us.  What
+	 * was written to a page of the page cache stays there and is written
+	 * back with it; a page past the end of the file only has its own
+	 * frame to free. */
+	pml4_clear_page (pml4, page->va);
+	void *kva = vm_frame_detach (page);
+	if (kva != NULL)
+		palloc_free_page (kva);
+}
 
-	file_close (aux->file);
+/* Write the dirty pages of AREA, a file mapping of the current process,
+ * between START and END back to the file, and mark them clean.  The
+ * pages live in the page cache, which writes runs of adjacent dirty
+ * pages together, and bytes beyond the file part of the mapping are
+ * never written.  Returns false if a write failed. */
+bool
+file_writeback (struct vm_area *area, void *start, void *end) {
+	size_t end_bytes = (uint8_t *) end - (uint8_t *) area->start;
 
-	if (page->frame != NULL) {
-		list_remove (&page->frame->frt_elem);
-		free (page->frame);
-	}
+	ASSERT (area->type == VM_FILE);
+
+	if (end_bytes > area->read_bytes)
+		end_bytes = area->read_bytes;
+	return page_cache_sync (file_get_inode (area->file),
+			vm_area_page_offset (area, start), area->ofs + end_bytes);
 }
 
 /* Do the mmap */
@@ -71,57 +100,145 @@ void *
 do_mmap (void *addr, size_t length, int writable, struct file *file, off_t offset) {
 	/* Maybe file is closed. If file is closed we loose inode data. So reopen it surely */
 	struct file *_file = file_reopen(file);
-	int read_length = length > file_length(_file) ? file_length(_file) : length;
 	
-	void *addr_original = addr;
+	if (_file == NULL) {
+		return NULL;
+	}
 	
-	while (read_length > 0) {
-		struct args_for_lazy_load_segment *aux = malloc(sizeof(struct args_for_lazy_load_segment));
-		
-		int size_to_read = read_length > PGSIZE ? PGSIZE : read_length;
-		
-		aux->file = _file;
-		aux->ofs = offset;
-		aux->page_read_bytes = read_length;
-		
-		bool alloc_result = vm_alloc_page_with_initializer(VM_FILE, addr, writable, lazy_load_segment, aux);
-		
-		if (alloc_result) {
-			offset += size_to_read;
-			addr += PGSIZE;
-			read_length -= size_to_read;
-		} else {
-			return NULL;
-		}
+	off_t file_left = file_length(_file) - offset;
+	
+	if (file_length(_file) == 0 || file_left < 0) {
+		file_close(_file);
+		return NULL;
 	}
 	
-	return addr_original;
+	size_t read_length = length > (size_t) file_left ? (size_t) file_left : length;
+	
+	/* Only the area is recorded here, its pages are created on fault. */
+	if (vm_area_create(&thread_current()->spt, addr, length, VM_FILE,
+				writable, _file, offset, read_length) == NULL) {
+		file_close(_file);
+		return NULL;
+	}
+	
+	return addr;
 }
 
 /* Do the munmap */
 void
 do_munmap (void *addr) {
-	struct thread *t = thread_current();
+	struct supplemental_page_table *spt = &thread_current()->spt;
+	struct vm_area *area = vm_area_find(spt, addr);
 	
-	for (;;) {
-		struct page *_page = spt_find_page(&t->spt, addr);
-		
-		if (_page == NULL) {
-			/* End */
-			return NULL;
-		}
-		
-		if (pml4_is_dirty(t->pml4, _page->va)) {
-			struct args_for_lazy_load_segment* aux = _page->uninit.aux;
-			file_write_at(aux->file, addr, aux->page_read_bytes, aux->ofs);
-			// clear
-			pml4_set_dirty(t->pml4, _page->va, 0);
-		}
-		
-		/* Clean up */
-		pml4_clear_page(t->pml4, _page->va);
-		
-		// NEXT
-		addr += PGSIZE;
+	/* ADDR must be the start of a mapping */
+	if (area == NULL || area->start != addr || area->type != VM_FILE) {
+		return;
+	}
+	
+	/* Writes back dirty pages, unmaps them and closes the file. */
+	uint64_t start = rdtsc();
+	
+	vm_area_destroy(spt, area);
+	munmap_cnt++;
+	munmap_cycles += rdtsc() - start;
+}
+
+/* Call FUNC on each part of [ADDR, ADDR + LENGTH) that lies in one area
+ * of the current process, with AUX.  Returns -1 if ADDR is not page
+ * aligned, the range is not all mapped or FUNC fails, 0 otherwise. */
+static int
+for_each_area (void *addr, size_t length,
+		bool (*func) (struct vm_area *, void *, void *, int), int aux) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	uint8_t *end = (uint8_t *) addr + ROUND_UP (length, PGSIZE);
+	uint8_t *va;
+
+	if (pg_ofs (addr) != 0 || end < (uint8_t *) addr
+			|| (length > 0 && !is_user_vaddr (end - 1)))
+		return -1;
+
+	for (va = addr; va < end; ) {
+		struct vm_area *area = vm_area_find (spt, va);
+		uint8_t *stop;
+
+		if (area == NULL)
+			return -1;
+		stop = end < (uint8_t *) area->end ? end : (uint8_t *) area->end;
+		if (!func (area, va, stop, aux))
+			return -1;
+		va = stop;
 	}
+	return 0;
+}
+
+/* msync() on the part [START, END) of AREA. */
+static bool
+msync_area (struct vm_area *area, void *start, void *end, int flags UNUSED) {
+	return area->type != VM_FILE || file_writeback (area, start, end);
+}
+
+/* Write the dirty pages of the file mappings in [ADDR, ADDR + LENGTH)
+ * back to their files.  Returns 0 on success, -1 on failure. */
+int
+do_msync (void *addr, size_t length, int flags) {
+	if ((flags & ~(MS_ASYNC | MS_SYNC)) != 0
+			|| (flags & (MS_ASYNC | MS_SYNC)) == (MS_ASYNC | MS_SYNC))
+		return -1;
+	return for_each_area (addr, length, msync_area, flags);
+}
+
+/* madvise() on the part [START, END) of AREA.  Access patterns apply
+ * to the whole area.  MADV_DONTNEED writes back and drops the pages of
+ * file mappings, which are read again on their next fault; anonymous
+ * memory is left alone. */
+static bool
+madvise_area (struct vm_area *area, void *start, void *end, int advice) {
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+	struct list_elem *e, *next;
+	struct tlb_batch batch;
+
+	switch (advice) {
+		case MADV_NORMAL:
+		case MADV_RANDOM:
+		case MADV_SEQUENTIAL:
+			area->advice = advice;
+			area->ra_pages = 0;
+			return true;
+		case MADV_WILLNEED:
+			vm_area_willneed (area, start, end);
+			return true;
+		case MADV_DONTNEED:
+			if (area->type != VM_FILE)
+				return true;
+			if (!file_writeback (area, start, end))
+				return false;
+			tlb_batch_begin (&batch);
+			for (e = list_begin (&area->pages); e != list_end (&area->pages);
+					e = next) {
+				struct page *page = list_entry (e, struct page, area_elem);
+
+				next = list_next (e);
+				if (start <= page->va && page->va < end)
+					spt_remove_page (spt, page);
+			}
+			tlb_batch_end (&batch);
+			return true;
+		default:
+			return false;
+	}
+}
+
+/* Apply ADVICE, a MADV_* value, to [ADDR, ADDR + LENGTH).  Returns 0 on
+ * success, -1 on failure. */
+int
+do_madvise (void *addr, size_t length, int advice) {
+	return for_each_area (addr, length, madvise_area, advice);
+}
+
+/* Prints statistics of file mappings. */
+void
+file_print_stats (void) {
+	printf ("Mmap: %zu munmaps, %llu cycles each\n", munmap_cnt,
+			munmap_cnt > 0 ? (unsigned long long) (munmap_cycles / munmap_cnt)
+			: 0);
 }
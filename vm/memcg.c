@@ -0,0 +1,221 @@
+/* memcg.c: Memory control groups.
+ *
+ * Every frame in the frame table is charged to the group of the
+ * process that allocated it, until it leaves the table.  A process is
+ * in the root group, which has no limits, until it creates a group of
+ * its own with memcg_create(); the children it forks afterwards join
+ * its group, and exec keeps it.
+ *
+ * A group at its hard limit gets no more frames: a frame it needs is
+ * reclaimed from its own frames instead, so that a runaway process
+ * pages against itself rather than pushing everyone else into swap.
+ * A group above its soft limit may grow, but when memory runs short
+ * the clock takes frames of such groups first.
+ *
+ * A group lives while it has processes or frames. */
+
+#include "vm/memcg.h"
+#include <debug.h>
+#include <stdio.h>
+#include <syscall-vm.h>
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+static struct memcg root_memcg;  /* The root group. */
+static struct list memcg_list;   /* The other groups. */
+static int next_id = 1;          /* Number of the next group. */
+static size_t over_soft_cnt;     /* Groups above their soft limit. */
+static struct lock memcg_lock;   /* Protects everything in this file. */
+
+/* Statistics. */
+static size_t create_cnt;        /* Groups created. */
+
+static void memcg_put (struct memcg *cg);
+
+void
+memcg_init (void) {
+	list_init (&memcg_list);
+	lock_init (&memcg_lock);
+}
+
+/* Returns the group of T. */
+struct memcg *
+memcg_of (struct thread *t) {
+	return t->memcg != NULL ? t->memcg : &root_memcg;
+}
+
+/* Returns true if CG is above its soft limit. */
+static bool
+over_soft (const struct memcg *cg) {
+	return cg->soft_limit != 0 && cg->usage > cg->soft_limit;
+}
+
+/* Create a group with the given limits and move the current process
+ * into it.  The frames the process has stay charged to its old group.
+ * Returns the number of the group, or -1 if the limits make no sense
+ * or memory ran out. */
+int
+memcg_enter_new (size_t soft_limit, size_t hard_limit) {
+	struct memcg *cg;
+
+	if (hard_limit != 0 && soft_limit > hard_limit)
+		return -1;
+	cg = calloc (1, sizeof *cg);
+	if (cg == NULL)
+		return -1;
+	cg->soft_limit = soft_limit;
+	cg->hard_limit = hard_limit;
+
+	lock_acquire (&memcg_lock);
+	cg->id = next_id++;
+	list_push_back (&memcg_list, &cg->elem);
+	create_cnt++;
+	lock_release (&memcg_lock);
+
+	memcg_attach (thread_current (), cg);
+	return cg->id;
+}
+
+/* Move T into CG, which may be NULL for the root group. */
+void
+memcg_attach (struct thread *t, struct memcg *cg) {
+	memcg_detach (t);
+	if (cg == NULL || cg == &root_memcg)
+		return;
+	lock_acquire (&memcg_lock);
+	cg->refs++;
+	t->memcg = cg;
+	lock_release (&memcg_lock);
+}
+
+/* Take T out of its group, back into the root group. */
+void
+memcg_detach (struct thread *t) {
+	struct memcg *cg = t->memcg;
+
+	if (cg == NULL)
+		return;
+	lock_acquire (&memcg_lock);
+	t->memcg = NULL;
+	cg->refs--;
+	memcg_put (cg);
+	lock_release (&memcg_lock);
+}
+
+/* Free CG if nothing refers to it anymore.  Caller must hold
+ * memcg_lock. */
+static void
+memcg_put (struct memcg *cg) {
+	if (cg != &root_memcg && cg->refs == 0 && cg->usage == 0) {
+		list_remove (&cg->elem);
+		free (cg);
+	}
+}
+
+/* Returns true if charging PAGES more frames would take CG beyond its
+ * hard limit. */
+bool
+memcg_at_limit (struct memcg *cg, size_t pages) {
+	return cg->hard_limit != 0 && cg->usage + pages > cg->hard_limit;
+}
+
+/* Returns true if CG is above its soft limit.  Only a snapshot. */
+bool
+memcg_over_soft (struct memcg *cg) {
+	return over_soft (cg);
+}
+
+/* Returns true if any group is above its soft limit.  Only a
+ * snapshot. */
+bool
+memcg_any_over_soft (void) {
+	return over_soft_cnt > 0;
+}
+
+/* Charge PAGES frames to CG. */
+void
+memcg_charge (struct memcg *cg, size_t pages) {
+	lock_acquire (&memcg_lock);
+	bool was_over = over_soft (cg);
+
+	cg->usage += pages;
+	if (cg->usage > cg->max_usage)
+		cg->max_usage = cg->usage;
+	if (!was_over && over_soft (cg))
+		over_soft_cnt++;
+	lock_release (&memcg_lock);
+}
+
+/* Take back the charge of PAGES frames from CG. */
+void
+memcg_uncharge (struct memcg *cg, size_t pages) {
+	lock_acquire (&memcg_lock);
+	bool was_over = over_soft (cg);
+
+	ASSERT (cg->usage >= pages);
+	cg->usage -= pages;
+	if (was_over && !over_soft (cg))
+		over_soft_cnt--;
+	memcg_put (cg);
+	lock_release (&memcg_lock);
+}
+
+/* Count a frame reclaimed from CG, because it was above its soft limit
+ * if SOFT is true and at its hard limit otherwise. */
+void
+memcg_count_reclaim (struct memcg *cg, bool soft) {
+	lock_acquire (&memcg_lock);
+	if (soft)
+		cg->soft_reclaim_cnt++;
+	else
+		cg->reclaim_cnt++;
+	lock_release (&memcg_lock);
+}
+
+/* Count a frame refused to CG at its hard limit. */
+void
+memcg_count_fail (struct memcg *cg) {
+	lock_acquire (&memcg_lock);
+	cg->fail_cnt++;
+	lock_release (&memcg_lock);
+}
+
+/* Fill STAT with the usage and statistics of CG. */
+void
+memcg_get_stat (struct memcg *cg, struct memcg_stat *stat) {
+	lock_acquire (&memcg_lock);
+	stat->id = cg->id;
+	stat->usage = cg->usage;
+	stat->max_usage = cg->max_usage;
+	stat->soft_limit = cg->soft_limit;
+	stat->hard_limit = cg->hard_limit;
+	stat->reclaims = cg->reclaim_cnt;
+	stat->soft_reclaims = cg->soft_reclaim_cnt;
+	stat->failures = cg->fail_cnt;
+	lock_release (&memcg_lock);
+}
+
+/* Prints the usage and statistics of every group. */
+static void
+print_group (const struct memcg *cg) {
+	printf ("Memcg %d: %zu pages, at most %zu, limits %zu/%zu, "
+			"%zu reclaimed at the hard limit, %zu above the soft limit, "
+			"%zu refused\n", cg->id, cg->usage, cg->max_usage,
+			cg->soft_limit, cg->hard_limit, cg->reclaim_cnt,
+			cg->soft_reclaim_cnt, cg->fail_cnt);
+}
+
+/* Prints statistics of the groups still alive. */
+void
+memcg_print_stats (void) {
+	struct list_elem *e;
+
+	lock_acquire (&memcg_lock);
+	printf ("Memcg: %zu groups created\n", create_cnt);
+	print_group (&root_memcg);
+	for (e = list_begin (&memcg_list); e != list_end (&memcg_list);
+			e = list_next (e))
+		print_group (list_entry (e, struct memcg, elem));
+	lock_release (&memcg_lock);
+}
@@ -2,4 +2,8 @@ vm_SRC = vm/vm.c          # Main api proxy
 vm_SRC += vm/uninit.c     # Uninitialized page
 vm_SRC += vm/anon.c       # Anonymous page
 vm_SRC += vm/file.c       # File mapped page
+vm_SRC += vm/area.c       # Virtual memory areas
+vm_SRC += vm/zswap.c      # Compressed swap cache
+vm_SRC += vm/memcg.c      # Memory control groups
+vm_SRC += filesys/page_cache.c  # Page cache
 vm_SRC += vm/inspect.c    # Testing utility
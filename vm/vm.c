@@ -1,11 +1,118 @@
 /* vm.c: Generic interface for virtual memory objects. */
 
+#include <round.h>
+#include <stdio.h>
+#include <string.h>
 #include "threads/malloc.h"
 #include "vm/vm.h"
 #include "vm/inspect.h"
+#include "vm/memcg.h"
+#include "vm/zswap.h"
 #include "threads/vaddr.h"
+#include "threads/mmu.h"
+#include "threads/synch.h"
+#include "devices/timer.h"
+#include "filesys/file.h"
+#include "userprog/process.h"
+#include <syscall-vm.h>
+#include "intrinsic.h"
 
 static struct list frame_table;
+static struct lock frame_lock;           /* Protects frame_table. */
+static struct list_elem *clock_hand;     /* Last frame the clock looked at. */
+
+/* Fault and eviction statistics. */
+static size_t fault_cnt;        /* Faults handled by vm_try_handle_fault. */
+static size_t evict_cnt;        /* Frames taken away from a page. */
+
+/* Free user pool pages below which frames are reclaimed.  Under LOW,
+ * kswapd is woken and evicts frames until HIGH pages are free again;
+ * under MIN, a thread that needs a frame evicts one itself.  Zero
+ * means a default derived from the size of the user pool.  Set with
+ * -wmark on the kernel command line. */
+size_t vm_wmark_min, vm_wmark_low, vm_wmark_high;
+
+/* Least number of pages the stack grows by at once.  Set with
+ * -stack-chunk on the kernel command line. */
+size_t vm_stack_chunk = 4;
+
+/* Print the memory use of every process at exit, after its exit
+ * status.  Set with -exit-vmstat on the kernel command line. */
+bool vm_exit_stats;
+
+/* Working set sampling.  Every WS_SAMPLE_TICKS, the accessed bits of
+ * a process are shifted into the history of its pages and cleared.
+ * A page is in the working set over N intervals if it was accessed in
+ * the current interval or one of the N - 1 before. */
+#define WS_SAMPLE_TICKS (TIMER_FREQ / 10)
+static const uint8_t ws_masks[3] = { 0x00, 0x07, 0x7f };
+
+static void kswapd (void *aux);
+static struct semaphore kswapd_wake;   /* Up'd to start a reclaim round. */
+static bool kswapd_awake;       /* Reclaim round in progress.
+                                   Protected by frame_lock. */
+
+/* Reclaim statistics. */
+static size_t kswapd_wake_cnt;  /* Reclaim rounds of kswapd. */
+static size_t kswapd_evict_cnt; /* Frames freed by kswapd. */
+static size_t direct_evict_cnt; /* Frames taken by a faulting thread. */
+
+/* Fault latency histogram: bucket B counts faults that took between
+ * 2^B and 2^(B+1) TSC cycles. */
+#define LATENCY_BUCKETS 64
+static size_t fault_latency[LATENCY_BUCKETS];
+
+/* The zero frame: one page of zeros, mapped read-only into untouched
+ * zero-filled pages until they are written.  It is not in the frame
+ * table, does not list its pages, and is pinned so that it is never
+ * chosen for eviction. */
+static struct frame zero_frame;
+static size_t zero_fault_cnt;   /* Read faults served by the zero frame. */
+static size_t zero_copy_cnt;    /* Zero pages written afterwards. */
+
+/* Readahead: frames of pages that the faulting process will likely
+ * touch soon are filled by a worker thread, and mapped on a later fault
+ * without waiting for the disk. */
+static struct list ra_queue;          /* Frames to fill, by io_elem. */
+static struct lock ra_lock;           /* Protects ra_queue. */
+static struct semaphore ra_sema;      /* Frames waiting in ra_queue. */
+static struct condition io_done;      /* Signaled, with frame_lock, when a
+                                         readahead frame is filled or
+                                         kswapd wrote a frame out. */
+static void readahead_worker (void *aux);
+static void frame_wait_io (struct page *page);
+
+/* Number of pages after a faulting page that are mapped in the same
+ * fault if their frames are already filled. */
+#define FAULT_AROUND_PAGES 16
+
+/* Readahead statistics. */
+static size_t ra_page_cnt;      /* Pages queued for readahead. */
+static size_t ra_hit_cnt;       /* Faults on pages read ahead. */
+static size_t fault_around_cnt; /* Pages mapped around a fault. */
+
+/* Text cache: frames holding read-only file contents of ELF segments,
+ * found by file and offset, so that every process running the same
+ * program maps the same frames instead of reading its own copy.  The
+ * pages sharing a frame are on its page list like pages shared
+ * copy-on-write, and the frame leaves the cache when it is evicted or
+ * its last page goes away.  Protected by frame_lock. */
+static struct hash text_cache;
+static size_t text_hit_cnt;     /* Faults served from the text cache. */
+static size_t text_fill_cnt;    /* Frames read and added to it. */
+static hash_hash_func text_hash;
+static hash_less_func text_less;
+
+/* Copy-on-write statistics. */
+static size_t fork_cnt;         /* Address spaces copied by fork. */
+static uint64_t fork_cycles;    /* TSC cycles spent copying them. */
+static size_t cow_share_cnt;    /* Frames shared with a child at fork. */
+static size_t cow_copy_cnt;     /* Write faults that copied a frame. */
+static size_t cow_reuse_cnt;    /* Write faults that took over a frame. */
+
+/* Transparent huge page statistics. */
+static size_t huge_fault_cnt;   /* Faults served by a whole huge frame. */
+static size_t huge_split_cnt;   /* Huge frames broken into 4 kB frames. */
 
 /* Initializes the virtual memory subsystem by invoking each subsystem's
  * intialize codes. */
@@ -13,166 +120,1689 @@ void
 vm_init (void) {
 	vm_anon_init ();
 	vm_file_init ();
-#ifdef EFILESYS  /* For project 4 */
 	pagecache_init ();
-#endif
 	register_inspect_intr ();
 	/* DO NOT MODIFY UPPER LINES. */
 	/* TODO: Your code goes here. */
 	list_init(&frame_table);
+	lock_init(&frame_lock);
+	hash_init(&text_cache, text_hash, text_less, NULL);
+	
+	/* Default watermarks: reclaim in the background once less than 1/32
+	 * of the user pool is free, up to 3/64 of it. */
+	size_t pool_pages = palloc_page_cnt(PAL_USER);
+	
+	if (vm_wmark_min == 0)
+		vm_wmark_min = pool_pages / 64 > 4 ? pool_pages / 64 : 4;
+	if (vm_wmark_low < vm_wmark_min)
+		vm_wmark_low = vm_wmark_min * 2;
+	if (vm_wmark_high < vm_wmark_low)
+		vm_wmark_high = vm_wmark_low + vm_wmark_min;
+	
+	zero_frame.kva = palloc_get_page(PAL_ASSERT | PAL_ZERO);
+	list_init(&zero_frame.pages);
+	zero_frame.pinned = true;
+	zero_frame.io_pending = false;
+	zero_frame.referenced = false;
+	zero_frame.text_cached = false;
+	zero_frame.memcg = NULL;
+	zero_frame.charged = 0;
+	memcg_init();
+	
+	sema_init(&kswapd_wake, 0);
+	thread_create("kswapd", PRI_DEFAULT, kswapd, NULL);
+	
+	list_init(&ra_queue);
+	lock_init(&ra_lock);
+	sema_init(&ra_sema, 0);
+	cond_init(&io_done);
+	thread_create("readahead", PRI_DEFAULT, readahead_worker, NULL);
+}
+
+/* Get the type of the page. This function is useful if you want to know the
+ * type of the page after it will be initialized.
+ * This function is fully implemented now. */
+enum vm_type
+page_get_type (struct page *page) {
+	int ty = VM_TYPE (page->operations->type);
+	switch (ty) {
+		case VM_UNINIT:
+			return VM_TYPE (page->uninit.type);
+		default:
+			return ty;
+	}
+}
+
+/* Helpers */
+static struct frame *vm_get_victim (struct memcg *cg);
+static bool vm_do_claim_page (struct page *page);
+static struct frame *vm_evict_frame (struct memcg *cg);
+static struct frame *vm_claim_frame (struct page *page);
+static bool vm_handle_fault (struct intr_frame *f, void *addr, bool user,
+		bool write, bool not_present);
+
+/* Create the pending page object with initializer. If you want to create a
+ * page, do not create it directly and make it through this function or
+ * `vm_alloc_page`. */
+bool
+vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
+		vm_initializer *init, void *aux) {
+
+	ASSERT (VM_TYPE(type) != VM_UNINIT)
+
+	struct supplemental_page_table *spt = &thread_current ()->spt;
+
+	/* Check wheter the upage is already occupied or not. */
+	if (spt_find_page (spt, upage) == NULL) {
+		struct page *spt_page_for_user_process = malloc(sizeof(struct page));
+		
+		switch (VM_TYPE(type)) {
+			case VM_ANON:
+				uninit_new(spt_page_for_user_process, upage, init, type, aux, anon_initializer);
+				break;
+			case VM_FILE:
+				uninit_new(spt_page_for_user_process, upage, init, type, aux, file_backed_initializer);
+				break;
+		}
+
+		spt_page_for_user_process->is_writable = writable;
+		spt_page_for_user_process->owner = thread_current ();
+		spt_page_for_user_process->ws_hist = 0;
+		return spt_insert_page(spt, spt_page_for_user_process);
+	}
+err:
+	return false;
+}
+
+/* Find VA from spt and return page. On error, return NULL. */
+struct page *
+spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
+	struct page key;
+	struct hash_elem *e;
+
+	key.va = pg_round_down(va);
+	e = hash_find(&spt->sptable_hash, &key.spt_elem);
+
+	return e != NULL ? hash_entry(e, struct page, spt_elem) : NULL;
+}
+
+/* Insert PAGE into spt with validation. */
+bool
+spt_insert_page (struct supplemental_page_table *spt UNUSED,
+		struct page *page UNUSED) {
+	return hash_insert(&spt->sptable_hash, &page->spt_elem) == NULL;
+}
+
+void
+spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
+	frame_wait_io (page);
+	hash_delete (&spt->sptable_hash, &page->spt_elem);
+	if (page->area != NULL)
+		list_remove (&page->area_elem);
+	vm_dealloc_page (page);
+}
+
+/* Returns true if FRAME holds a page of the page cache. */
+static bool
+frame_is_cache (const struct frame *frame) {
+	return frame->page != NULL
+		&& frame->page->operations->type == VM_PAGE_CACHE;
+}
+
+/* Returns true if the pages mapping FRAME share it copy-on-write, so
+ * that it must stay read-only.  Mappings of a frame of the page cache
+ * share it writably. */
+static bool
+frame_cow (struct frame *frame) {
+	return list_size (&frame->pages) > 1 && !frame_is_cache (frame);
+}
+
+/* Returns true if any page mapping FRAME was accessed since the bit was
+ * last cleared, here or by the working set sampler.  Clears the accessed
+ * bits if CLEAR is true. */
+static bool
+frame_test_accessed (struct frame *frame, bool clear) {
+	bool accessed = frame->referenced;
+	struct list_elem *e;
+
+	if (clear)
+		frame->referenced = false;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (pml4 != NULL && pml4_is_accessed (pml4, page->va)) {
+			accessed = true;
+			if (clear)
+				pml4_set_accessed (pml4, page->va, false);
+		}
+	}
+	return accessed;
+}
+
+/* Returns true if any page mapping FRAME was written to, or write()
+ * wrote to it if it is in the page cache. */
+static bool
+frame_is_dirty (struct frame *frame) {
+	struct list_elem *e;
+
+	if (frame_is_cache (frame) && frame->page->page_cache.dirty)
+		return true;
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (pml4 != NULL && pml4_is_dirty (pml4, page->va))
+			return true;
+	}
+	return false;
+}
+
+/* Collect the dirty bits of the mappings of FRAME, a frame of the page
+ * cache, into its page, and clear them.  Returns true if the page is
+ * dirty.  Caller must hold frame_lock. */
+static bool
+frame_cache_dirty (struct frame *frame) {
+	struct page *cpage = frame->page;
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		if (pml4 != NULL && pml4_is_dirty (pml4, page->va)) {
+			pml4_set_dirty (pml4, page->va, false);
+			cpage->page_cache.dirty = true;
+		}
+	}
+	return cpage->page_cache.dirty;
+}
+
+/* Move the clock hand to the next frame of the table, wrapping around
+ * at the end, and return that frame. */
+static struct frame *
+clock_advance (void) {
+	if (clock_hand == NULL || clock_hand == list_end (&frame_table))
+		clock_hand = list_begin (&frame_table);
+	else {
+		clock_hand = list_next (clock_hand);
+		if (clock_hand == list_end (&frame_table))
+			clock_hand = list_begin (&frame_table);
+	}
+	return list_entry (clock_hand, struct frame, frt_elem);
+}
+
+/* Remove FRAME from the frame table, keeping the clock hand valid,
+ * and take its charge back from its memory control group.
+ * Caller must hold frame_lock. */
+static void
+frame_table_remove (struct frame *frame) {
+	if (frame->text_cached) {
+		hash_delete (&text_cache, &frame->text_elem);
+		frame->text_cached = false;
+	}
+	if (clock_hand == &frame->frt_elem)
+		clock_hand = list_prev (clock_hand);
+	list_remove (&frame->frt_elem);
+	if (frame->charged > 0) {
+		memcg_uncharge (frame->memcg, frame->charged);
+		frame->charged = 0;
+	}
+}
+
+/* Add FRAME, holding no page yet, to the frame table, pinned, and
+ * charge it to memory control group CG.
+ * Caller must hold frame_lock. */
+static void
+frame_table_insert (struct frame *frame, struct memcg *cg) {
+	frame->page = NULL;
+	list_init (&frame->pages);
+	frame->huge_refs = 0;
+	frame->pinned = true;
+	frame->io_pending = false;
+	frame->referenced = false;
+	frame->text_cached = false;
+	frame->memcg = cg;
+	frame->charged = 1;
+	memcg_charge (cg, 1);
+	list_push_back (&frame_table, &frame->frt_elem);
+}
+
+/* Returns a hash value for frame F of the text cache. */
+static uint64_t
+text_hash (const struct hash_elem *f_, void *aux UNUSED) {
+	const struct frame *f = hash_entry (f_, struct frame, text_elem);
+
+	return hash_bytes (&f->text.inode, sizeof f->text.inode)
+		^ hash_int (f->text.ofs);
+}
+
+/* Returns true if the contents of text cache frame A precede those of
+ * frame B. */
+static bool
+text_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct text_key *a = &hash_entry (a_, struct frame, text_elem)->text;
+	const struct text_key *b = &hash_entry (b_, struct frame, text_elem)->text;
+
+	if (a->inode != b->inode)
+		return a->inode < b->inode;
+	if (a->ofs != b->ofs)
+		return a->ofs < b->ofs;
+	return a->read_bytes < b->read_bytes;
+}
+
+/* If the page at VA in AREA may be shared through the text cache,
+ * that is, it is part of a read-only ELF segment and comes from the
+ * file, sets KEY to its contents and returns true. */
+static bool
+text_key (const struct vm_area *area, const void *va, struct text_key *key) {
+	if (area->type != VM_ANON || area->writable || area->file == NULL)
+		return false;
+	key->read_bytes = vm_area_page_read_bytes (area, va);
+	if (key->read_bytes == 0)
+		return false;
+	key->inode = file_get_inode (area->file);
+	key->ofs = vm_area_page_offset (area, va);
+	return true;
+}
+
+/* Returns the frame of the text cache that holds KEY, or NULL.
+ * Caller must hold frame_lock. */
+static struct frame *
+text_cache_find (const struct text_key *key) {
+	struct frame f;
+	struct hash_elem *e;
+
+	f.text = *key;
+	e = hash_find (&text_cache, &f.text_elem);
+	return e != NULL ? hash_entry (e, struct frame, text_elem) : NULL;
+}
+
+/* Add FRAME, just filled for PAGE, to the text cache if PAGE may be
+ * shared and no other frame holds its contents yet.
+ * Caller must hold frame_lock. */
+static void
+text_cache_add (struct frame *frame, struct page *page) {
+	if (page->area == NULL || !text_key (page->area, page->va, &frame->text))
+		return;
+	if (hash_insert (&text_cache, &frame->text_elem) == NULL) {
+		frame->text_cached = true;
+		text_fill_cnt++;
+	}
+}
+
+/* Enhanced second chance: the clock hand sweeps the frame table looking
+ * first for a frame that is neither accessed nor dirty, then for one
+ * that is not accessed, clearing accessed bits as it passes. Four sweeps
+ * always find a victim. Pinned frames, which are being filled, are
+ * never chosen.  Only frames charged to CG are considered if CG is not
+ * NULL, and only frames of groups above their soft limit if OVER_SOFT
+ * is true. */
+static struct frame *
+clock_scan (struct memcg *cg, bool over_soft) {
+	size_t cnt = list_size (&frame_table);
+
+	for (int sweep = 0; sweep < 4; sweep++) {
+		bool want_clean = sweep % 2 == 0;
+
+		for (size_t i = 0; i < cnt; i++) {
+			struct frame *frame = clock_advance ();
+
+			if (frame->pinned || frame->page == NULL)
+				continue;
+			if ((cg != NULL && frame->memcg != cg)
+					|| (over_soft && !memcg_over_soft (frame->memcg)))
+				continue;
+			if (want_clean) {
+				if (!frame_test_accessed (frame, false) && !frame_is_dirty (frame))
+					return frame;
+			} else if (!frame_test_accessed (frame, true))
+				return frame;
+		}
+	}
+	return NULL;
+}
+
+/* Get the struct frame, that will be evicted.
+ * With CG, the victim is one of the frames charged to CG, which is at
+ * its hard limit.  Otherwise, frames of groups above their soft limit
+ * go first, and any frame after them. */
+static struct frame *
+vm_get_victim (struct memcg *cg) {
+	struct frame *victim;
+
+	if (cg != NULL)
+		return clock_scan (cg, false);
+	if (memcg_any_over_soft () && (victim = clock_scan (NULL, true)) != NULL) {
+		memcg_count_reclaim (victim->memcg, true);
+		return victim;
+	}
+	return clock_scan (NULL, false);
+}
+
+/* Returns the page at VA of T if it may be swapped out together with
+ * a neighbouring victim: a resident anonymous page with a frame of its
+ * own that is not in use. */
+static struct page *
+cluster_page (struct thread *t, uint8_t *va) {
+	struct page *page;
+	struct frame *frame;
+
+	if (!is_user_vaddr (va) || va == NULL)
+		return NULL;
+	page = spt_find_page (&t->spt, va);
+	if (page == NULL || page->operations->type != VM_ANON
+			|| (frame = page->frame) == NULL)
+		return NULL;
+	if (frame->pinned || frame->huge_refs > 0
+			|| list_size (&frame->pages) != 1
+			|| pml4_is_accessed (t->pml4, va))
+		return NULL;
+	return page;
+}
+
+/* Fill CLUSTER with PAGE and the anonymous pages right after and
+ * before it that can be swapped out with it in one write, in address
+ * order, and return their number.  Only the current process's own
+ * pages are clustered, because the supplemental page table of another
+ * process may be in the middle of a change. */
+static size_t
+evict_cluster (struct page *page, struct page *cluster[]) {
+	struct thread *t = thread_current ();
+	uint8_t *va = page->va;
+	size_t after = 0, before = 0, i;
+
+	if (page->operations->type == VM_ANON && page->owner == t) {
+		while (after + 1 < SWAP_CLUSTER_MAX
+				&& cluster_page (t, va + (after + 1) * PGSIZE) != NULL)
+			after++;
+		while (before + after + 1 < SWAP_CLUSTER_MAX
+				&& (uint64_t) va >= (before + 1) * PGSIZE
+				&& cluster_page (t, va - (before + 1) * PGSIZE) != NULL)
+			before++;
+	}
+
+	for (i = 0; i < before + after + 1; i++)
+		cluster[i] = i == before ? page
+			: spt_find_page (&t->spt, va - before * PGSIZE + i * PGSIZE);
+	return before + after + 1;
+}
+
+/* Remove every mapping of FRAME from the page tables, keeping the
+ * accessed and dirty bits. */
+static void
+frame_unmap (struct frame *frame) {
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+
+		if (page->owner->pml4 != NULL)
+			pml4_clear_page (page->owner->pml4, page->va);
+	}
+}
+
+/* Map FRAME again into every page using it, after a failed swap-out.
+ * The mappings are marked dirty so that the contents are not lost.  A
+ * frame shared copy-on-write stays read-only. */
+static void
+frame_remap (struct frame *frame) {
+	bool shared = frame_cow (frame);
+	struct list_elem *e;
+
+	for (e = list_begin (&frame->pages); e != list_end (&frame->pages);
+			e = list_next (e)) {
+		struct page *page = list_entry (e, struct page, frame_elem);
+		uint64_t *pml4 = page->owner->pml4;
+
+		/* The page table is still there, so this cannot fail. */
+		if (pml4 != NULL && pml4_set_page (pml4, page->va, frame->kva,
+					page->is_writable && !shared))
+			pml4_set_dirty (pml4, page->va, true);
+	}
+}
+
+/* First step of an eviction: choose a victim and unmap it, together
+ * with the anonymous pages next to it that can be swapped out in the
+ * same write, which are stored in CLUSTER and counted in *CNT.  With
+ * CG, the victim is one of the frames charged to CG.  Returns the
+ * victim, or NULL if there is none.  Caller must hold frame_lock. */
+static struct frame *
+evict_begin (struct memcg *cg, struct page *cluster[], size_t *cnt) {
+	struct frame *victim = vm_get_victim (cg);
+	struct tlb_batch batch;
+	size_t i;
+
+	if (victim == NULL)
+		return NULL;
+
+	/* Only one 4 kB page of a huge frame leaves memory at a time. */
+	if (victim->huge_refs > 0) {
+		struct page *head = victim->page;
+
+		if (!vm_split_huge_frame (victim))
+			return NULL;
+		victim = head->frame;
+	}
+
+	/* Unmap first, so that the pages cannot change while they are
+	 * being saved, and drop the TLB entries of the cluster together. */
+	*cnt = evict_cluster (victim->page, cluster);
+	tlb_batch_begin (&batch);
+	for (i = 0; i < *cnt; i++)
+		frame_unmap (cluster[i]->frame);
+	tlb_batch_end (&batch);
+
+	/* The page cache writes its page back if a mapping wrote to it. */
+	if (frame_is_cache (victim))
+		frame_cache_dirty (victim);
+	return victim;
+}
+
+/* Second step: save the CNT pages of CLUSTER, VICTIM among them, to
+ * swap or to their files.  Returns false if that failed.  This is the
+ * part that may wait for the disk: kswapd runs it without frame_lock,
+ * having marked the frames busy. */
+static bool
+evict_write (struct frame *victim, struct page *cluster[], size_t cnt) {
+	return cnt > 1 ? anon_swap_out_cluster (cluster, cnt)
+		: swap_out (victim->page);
+}
+
+/* Last step: if OK, release the frames of the CNT pages of CLUSTER and
+ * return VICTIM, emptied, to the caller; otherwise map the pages again
+ * and return NULL.  Caller must hold frame_lock. */
+static struct frame *
+evict_finish (struct frame *victim, struct page *cluster[], size_t cnt,
+		bool ok) {
+	size_t i;
+
+	if (!ok) {
+		for (i = 0; i < cnt; i++)
+			frame_remap (cluster[i]->frame);
+		return NULL;
+	}
+
+	for (i = 0; i < cnt; i++) {
+		struct frame *frame = cluster[i]->frame;
+		bool cache = frame_is_cache (frame);
+
+		/* Pages sharing an anonymous frame now share its swap slot.
+		 * Mappings of the page cache map it again on their next fault. */
+		while (!list_empty (&frame->pages)) {
+			struct page *page = list_entry (list_pop_front (&frame->pages),
+					struct page, frame_elem);
+			if (page != cluster[i] && !cache)
+				anon_share (page, cluster[i]);
+			page->frame = NULL;
+		}
+		cluster[i]->frame = NULL;
+		frame_table_remove (frame);
+		if (frame != victim) {
+			palloc_free_page (frame->kva);
+			free (frame);
+		}
+	}
+
+	victim->page = NULL;
+	evict_cnt += cnt;
+	return victim;
+}
+
+/* Evict one page and return the corresponding frame.  With CG, the
+ * page is one of those whose frames are charged to CG.
+ * Anonymous pages next to the victim are swapped out with it in the
+ * same write, and their frames go back to the user pool.
+ * Caller must hold frame_lock, which stays held throughout.
+ * Return NULL on error.*/
+static struct frame *
+vm_evict_frame (struct memcg *cg) {
+	struct page *cluster[SWAP_CLUSTER_MAX];
+	struct frame *victim;
+	size_t cnt;
+
+	victim = evict_begin (cg, cluster, &cnt);
+	if (victim == NULL)
+		return NULL;
+	return evict_finish (victim, cluster, cnt,
+			evict_write (victim, cluster, cnt));
+}
+
+/* Wake kswapd, unless it is already reclaiming.
+ * Caller must hold frame_lock. */
+static void
+kswapd_poke (void) {
+	if (!kswapd_awake) {
+		kswapd_awake = true;
+		kswapd_wake_cnt++;
+		sema_up (&kswapd_wake);
+	}
+}
+
+/* Page reclaim daemon.  Woken when fewer than vm_wmark_low user pages
+ * are free, it evicts frames until vm_wmark_high pages are free again,
+ * so that a fault rarely has to wait for a victim to be written out.
+ * The frame lock is only held to choose and unmap a victim and to free
+ * it afterwards: the victim is pinned and marked io_pending while it is
+ * written out, so that faults on it wait in vm_map_resident() and every
+ * other fault goes through.  The zswap pool is kept from filling up
+ * here too.  Pages are written out one at a time,
+ * since only a process itself can safely look up the neighbours of a
+ * page for a clustered write. */
+static void
+kswapd (void *aux UNUSED) {
+	for (;;) {
+		sema_down (&kswapd_wake);
+
+		lock_acquire (&frame_lock);
+		while (palloc_free_cnt (PAL_USER) < vm_wmark_high) {
+			struct page *cluster[SWAP_CLUSTER_MAX];
+			struct frame *victim;
+			size_t cnt;
+			bool ok;
+
+			victim = evict_begin (NULL, cluster, &cnt);
+			if (victim == NULL)
+				break;
+			ASSERT (cnt == 1);
+			victim->pinned = true;
+			victim->io_pending = true;
+			lock_release (&frame_lock);
+
+			/* Make room in the zswap pool for the victim, writing
+			 * its coldest pages to the disk from here rather than on
+			 * a fault. */
+			zswap_shrink ();
+			ok = evict_write (victim, cluster, cnt);
+
+			lock_acquire (&frame_lock);
+			victim->io_pending = false;
+			victim->pinned = false;
+			cond_broadcast (&io_done, &frame_lock);
+			if (evict_finish (victim, cluster, cnt, ok) == NULL)
+				break;
+			palloc_free_page (victim->kva);
+			free (victim);
+			kswapd_evict_cnt++;
+		}
+		kswapd_awake = false;
+		lock_release (&frame_lock);
+	}
+}
+
+/* palloc() and get frame. If there is no available page, evict the page
+ * and return it. This always return valid address. That is, if the user pool
+ * memory is full, this function evicts the frame to get the available memory
+ * space. Returns NULL only if nothing could be evicted.
+ * Normally kswapd keeps enough frames free.  Only when the free count
+ * falls to vm_wmark_min does the caller evict a frame itself.
+ * A process whose memory control group is at its hard limit reclaims
+ * one of the group's own frames instead, whatever the free count.
+ * The frame is returned pinned; vm_do_claim_page unpins it once filled. */
+static struct frame *
+vm_get_frame (void) {
+	struct frame *frame = NULL;
+	void* candidate_virtual_address = NULL;
+	struct memcg *cg = memcg_of(thread_current());
+	
+	// Above the min watermark no reclaim is needed: take the page before
+	// frame_lock, so that the fault does not wait behind kswapd.
+	if (palloc_free_cnt(PAL_USER) > vm_wmark_min && !memcg_at_limit(cg, 1))
+		candidate_virtual_address = palloc_get_page(PAL_USER);
+	
+	lock_acquire(&frame_lock);
+	size_t free_cnt = palloc_free_cnt(PAL_USER);
+	
+	if (memcg_at_limit(cg, 1)) {
+		if (candidate_virtual_address != NULL)
+			palloc_free_page(candidate_virtual_address);
+		frame = vm_evict_frame(cg);
+		
+		if (frame != NULL) {
+			memcg_count_reclaim(cg, false);
+			frame_table_insert(frame, cg);
+		} else
+			memcg_count_fail(cg);
+		lock_release(&frame_lock);
+		return frame;
+	}
+	
+	if (free_cnt < vm_wmark_low)
+		kswapd_poke();
+	
+	if (candidate_virtual_address == NULL) {
+		// Under the min watermark or USER POOL IS FULL: reclaim directly.
+		frame = vm_evict_frame(NULL);
+		
+		if (frame != NULL)
+			direct_evict_cnt++;
+		else
+			candidate_virtual_address = palloc_get_page(PAL_USER);
+	}
+	
+	if (candidate_virtual_address != NULL) {
+		frame = malloc(sizeof(struct frame));
+		
+		if (frame == NULL) {
+			palloc_free_page(candidate_virtual_address);
+		} else {
+			frame->kva = candidate_virtual_address;
+		}
+	}
+	
+	if (frame != NULL) {
+		frame_table_insert(frame, cg);
+	}
+	lock_release(&frame_lock);
+
+	ASSERT (frame == NULL || frame->page == NULL);
+	return frame;
+}
+
+/* Give PAGE, which is not resident, a pinned frame for read-ahead,
+ * without mapping it, and hand it to the readahead thread to fill if
+ * QUEUE is true.  Unlike a fault, read-ahead never evicts anything, so
+ * this returns NULL once free frames fall under the low watermark or
+ * the memory control group of the owner of PAGE is at its hard limit.
+ * A page of the page cache is charged to the current process, and
+ * NULL is also returned if it became resident in the meantime. */
+static struct frame *
+frame_alloc_ahead (struct page *page, bool queue) {
+	struct memcg *cg = memcg_of (page->owner != NULL ? page->owner
+			: thread_current ());
+	struct frame *frame;
+	void *kva;
+
+	if (palloc_free_cnt (PAL_USER) < vm_wmark_low
+			|| memcg_at_limit (cg, 1))
+		return NULL;
+	kva = palloc_get_page (PAL_USER);
+	if (kva == NULL)
+		return NULL;
+	frame = malloc (sizeof (struct frame));
+	if (frame == NULL) {
+		palloc_free_page (kva);
+		return NULL;
+	}
+	frame->kva = kva;
+
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL || memcg_at_limit (cg, 1)) {
+		lock_release (&frame_lock);
+		palloc_free_page (kva);
+		free (frame);
+		return NULL;
+	}
+	frame_table_insert (frame, cg);
+	frame->page = page;
+	frame->io_pending = queue;
+	page->frame = frame;
+	if (!frame_is_cache (frame))
+		list_push_back (&frame->pages, &page->frame_elem);
+	lock_release (&frame_lock);
+
+	if (queue) {
+		lock_acquire (&ra_lock);
+		list_push_back (&ra_queue, &frame->io_elem);
+		lock_release (&ra_lock);
+		sema_up (&ra_sema);
+		ra_page_cnt++;
+	}
+	return frame;
+}
+
+/* Give PAGE, which is not resident, a frame for read-ahead and map it.
+ * Returns the kernel virtual address of the frame, which is pinned
+ * until the caller has filled it and calls vm_frame_unpin, or NULL if
+ * free frames are short. */
+void *
+vm_frame_prefetch (struct page *page) {
+	struct frame *frame = frame_alloc_ahead (page, false);
+
+	if (frame == NULL)
+		return NULL;
+	if (!pml4_set_page (page->owner->pml4, page->va, frame->kva,
+				page->is_writable)) {
+		palloc_free_page (vm_frame_detach (page));
+		return NULL;
+	}
+	return frame->kva;
+}
+
+/* Wait until the readahead thread is done with the frame of PAGE. */
+static void
+frame_wait_io (struct page *page) {
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->io_pending)
+		cond_wait (&io_done, &frame_lock);
+	lock_release (&frame_lock);
+}
+
+/* Readahead thread.  Fills the frames queued by readahead() from their
+ * pages' areas, one at a time, and unpins them.  The owner of a page
+ * maps the frame on its next fault, or it is reclaimed like any other
+ * frame.  A page whose read fails loses its frame and is read again
+ * on its fault. */
+static void
+readahead_worker (void *aux UNUSED) {
+	for (;;) {
+		struct frame *frame;
+		struct page *page;
+		bool ok;
+
+		sema_down (&ra_sema);
+		lock_acquire (&ra_lock);
+		frame = list_entry (list_pop_front (&ra_queue), struct frame, io_elem);
+		lock_release (&ra_lock);
+
+		page = frame->page;
+		ok = swap_in (page, frame->kva);
+
+		lock_acquire (&frame_lock);
+		if (!ok) {
+			if (!frame_is_cache (frame))
+				list_remove (&page->frame_elem);
+			page->frame = NULL;
+			frame_table_remove (frame);
+			palloc_free_page (frame->kva);
+			free (frame);
+		} else {
+			frame->io_pending = false;
+			frame->pinned = false;
+			text_cache_add (frame, page);
+		}
+		cond_broadcast (&io_done, &frame_lock);
+		lock_release (&frame_lock);
+	}
+}
+
+/* Returns true if the page at VA in AREA is in the text cache, so that
+ * its fault maps it without reading it. */
+static bool
+text_cache_has (const struct vm_area *area, const void *va) {
+	struct text_key key;
+	bool found;
+
+	if (!text_key (area, va, &key))
+		return false;
+	lock_acquire (&frame_lock);
+	found = text_cache_find (&key) != NULL;
+	lock_release (&frame_lock);
+	return found;
+}
+
+/* Queue the pages of AREA from START on, up to CNT of them, for
+ * readahead, skipping pages that were already faulted in.  Stops at
+ * the end of the file part of the area, or when free frames run
+ * short. */
+static void
+readahead_queue (struct vm_area *area, uint8_t *start, size_t cnt) {
+	struct thread *t = thread_current ();
+	size_t i;
+
+	for (i = 0; i < cnt; i++) {
+		uint8_t *va = start + i * PGSIZE;
+		struct page *page;
+
+		if ((void *) va >= area->end || vm_area_page_read_bytes (area, va) == 0)
+			break;
+		if (spt_find_page (&t->spt, va) != NULL || text_cache_has (area, va))
+			continue;
+
+		/* File data is read into the page cache, and mapped from there. */
+		if (area->type == VM_FILE) {
+			if (!page_cache_prefetch (file_get_inode (area->file),
+						vm_area_page_offset (area, va)))
+				break;
+			continue;
+		}
+		if ((page = vm_area_alloc_page (area, va, true)) == NULL
+				|| frame_alloc_ahead (page, true) == NULL) {
+			if (page != NULL)
+				spt_remove_page (&t->spt, page);
+			break;
+		}
+	}
+}
+
+/* Read the CNT pages of AREA from START on ahead, as the next window
+ * of sequential readahead. */
+static void
+readahead_window (struct vm_area *area, uint8_t *start, size_t cnt) {
+	area->ra_start = start;
+	area->ra_pages = cnt;
+	area->ra_next = start + cnt * PGSIZE;
+	readahead_queue (area, start, cnt);
+}
+
+/* Track the faults on AREA and read ahead when they are sequential.
+ * VA is the faulting page; HIT tells whether it had been read ahead.
+ * A miss right after the previous fault opens a window after VA; a hit
+ * on the first page of the last window opens the next, twice as large,
+ * so that reads stay ahead of the process.  After MADV_SEQUENTIAL every
+ * miss opens a window, at full size; after MADV_RANDOM nothing is read
+ * ahead. */
+static void
+readahead (struct vm_area *area, uint8_t *va, bool hit) {
+	bool sequential = area->advice == MADV_SEQUENTIAL
+		|| (area->ra_prev != NULL && va == (uint8_t *) area->ra_prev + PGSIZE);
+	size_t cnt = area->advice == MADV_SEQUENTIAL ? RA_MAX_PAGES
+		: area->ra_pages * 2;
+
+	if (cnt < RA_MIN_PAGES)
+		cnt = RA_MIN_PAGES;
+	if (cnt > RA_MAX_PAGES)
+		cnt = RA_MAX_PAGES;
+
+	area->ra_prev = va;
+	if (area->file == NULL || area->advice == MADV_RANDOM)
+		return;
+
+	if (hit) {
+		if (va == area->ra_start)
+			readahead_window (area, area->ra_next, cnt);
+	} else if (sequential)
+		readahead_window (area, va + PGSIZE, cnt);
+	else
+		area->ra_pages = 0;
+}
+
+/* Start reading the file pages of AREA between START and END, for
+ * MADV_WILLNEED.  The sequential readahead window is left alone. */
+void
+vm_area_willneed (struct vm_area *area, void *start, void *end) {
+	uint8_t *va;
+
+	if (area->file == NULL)
+		return;
+	for (va = start; (void *) va < end; va += RA_MAX_PAGES * PGSIZE) {
+		size_t cnt = ((uint8_t *) end - va) / PGSIZE;
+
+		readahead_queue (area, va, cnt < RA_MAX_PAGES ? cnt : RA_MAX_PAGES);
+	}
+}
+
+/* Map the pages after PAGE, within its area, whose frames were already
+ * filled by readahead, so that they take no fault of their own.  Not
+ * done after MADV_RANDOM. */
+static void
+fault_around (struct page *page) {
+	struct thread *t = thread_current ();
+	size_t i;
+
+	if (page->area->advice == MADV_RANDOM)
+		return;
+	lock_acquire (&frame_lock);
+	for (i = 1; i < FAULT_AROUND_PAGES; i++) {
+		uint8_t *va = (uint8_t *) page->va + i * PGSIZE;
+		struct page *next;
+
+		if ((void *) va >= page->area->end)
+			break;
+		next = spt_find_page (&t->spt, va);
+		if (next == NULL || next->frame == NULL || next->frame->io_pending
+				|| next->frame == &zero_frame
+				|| pml4_get_page (t->pml4, va) != NULL)
+			continue;
+		if (pml4_set_page (t->pml4, va, next->frame->kva, next->is_writable
+					&& !frame_cow (next->frame)))
+			fault_around_cnt++;
+	}
+	lock_release (&frame_lock);
+}
+
+/* Map PAGE, which was not faulted in yet, to the frame of the text
+ * cache that holds its contents, if there is one.  The page becomes an
+ * anonymous page sharing the frame, read-only like the segment. */
+static bool
+vm_map_text (struct page *page) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	struct text_key key;
+	struct frame *frame;
+	bool mapped = false;
+
+	if (page->operations->type != VM_UNINIT || page->area == NULL
+			|| !text_key (page->area, page->va, &key))
+		return false;
+
+	lock_acquire (&frame_lock);
+	frame = text_cache_find (&key);
+	if (frame != NULL && !frame->io_pending
+			&& pml4_set_page (pml4, page->va, frame->kva, false)) {
+		anon_share (page, frame->page);
+		page->frame = frame;
+		list_push_back (&frame->pages, &page->frame_elem);
+		text_hit_cnt++;
+		mapped = true;
+	}
+	lock_release (&frame_lock);
+	return mapped;
+}
+
+/* Wait until the readahead thread is done with the frame of PAGE, a
+ * page of the page cache.  Caller must hold frame_lock. */
+static void
+cache_wait_io (struct page *page) {
+	while (page->frame != NULL && page->frame->io_pending) {
+		thread_current ()->fault_io = true;
+		cond_wait (&io_done, &frame_lock);
+	}
+}
+
+/* Unpin the frame of PAGE, a page of the page cache, marking it dirty
+ * if DIRTY is true.  Caller must hold frame_lock. */
+static void
+cache_unpin (struct page *page, bool dirty) {
+	struct page_cache *pc = &page->page_cache;
+
+	ASSERT (pc->pin_cnt > 0);
+	if (dirty)
+		pc->dirty = true;
+	if (--pc->pin_cnt == 0) {
+		page->frame->pinned = false;
+		cond_broadcast (&io_done, &frame_lock);
+	}
+}
+
+/* Returns true if PAGE maps file data, and so shares the frames of the
+ * page cache. */
+static bool
+page_maps_cache (struct page *page) {
+	return page->area != NULL && VM_TYPE (page->area->type) == VM_FILE
+		&& vm_area_page_read_bytes (page->area, page->va) > 0;
+}
+
+/* Map PAGE, which maps file data, to the frame of the page cache that
+ * holds it, reading it in first if necessary, and set *HIT to whether
+ * it was resident already.  Mappings share the frame writably: what
+ * they write is written back with the page cache. */
+static bool
+vm_map_cache (struct page *page, bool *hit) {
+	struct vm_area *area = page->area;
+	uint64_t *pml4 = thread_current ()->pml4;
+	struct page *cpage;
+	void *kva;
+	bool mapped;
+
+	cpage = page_cache_lookup (file_get_inode (area->file),
+			vm_area_page_offset (area, page->va), true);
+	if (cpage == NULL)
+		return false;
+	lock_acquire (&frame_lock);
+	*hit = cpage->frame != NULL;
+	lock_release (&frame_lock);
+	if ((kva = vm_cache_pin (cpage, true)) == NULL)
+		return false;
+
+	lock_acquire (&frame_lock);
+	mapped = pml4_set_page (pml4, page->va, kva, page->is_writable);
+	if (mapped) {
+		if (page->operations->type == VM_UNINIT)
+			file_backed_initializer (page, VM_FILE, kva);
+		page->frame = cpage->frame;
+		list_push_back (&cpage->frame->pages, &page->frame_elem);
+	}
+	cache_unpin (cpage, false);
+	lock_release (&frame_lock);
+	return mapped;
+}
+
+/* If PAGE has a frame but is not mapped, because the frame was read
+ * ahead, wait for the read and map it, setting *MAPPED to the result.
+ * Returns false if PAGE has no frame. */
+static bool
+vm_map_resident (struct page *page, bool *mapped) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && page->frame->io_pending) {
+		thread_current ()->fault_io = true;
+		cond_wait (&io_done, &frame_lock);
+	}
+	frame = page->frame;
+	if (frame != NULL)
+		*mapped = pml4_set_page (pml4, page->va, frame->kva,
+				page->is_writable && frame != &zero_frame
+				&& !frame_cow (frame));
+	lock_release (&frame_lock);
+	return frame != NULL;
+}
+
+/* Let the clock choose the frame of PAGE again. */
+void
+vm_frame_unpin (struct page *page) {
+	page->frame->pinned = false;
+}
+
+/* Pin the frame of PAGE, a page of the page cache, so that it is not
+ * evicted while the caller copies data in or out of it, and return its
+ * kernel virtual address.  A page that is not resident gets a frame,
+ * filled from its file if FILL is true and zeroed otherwise.  Returns
+ * NULL if that fails. */
+void *
+vm_cache_pin (struct page *page, bool fill) {
+	struct frame *frame;
+	bool ok = true;
+
+	lock_acquire (&frame_lock);
+	cache_wait_io (page);
+	if (page->frame != NULL) {
+		page->frame->pinned = true;
+		page->frame->referenced = true;
+		page->page_cache.pin_cnt++;
+		lock_release (&frame_lock);
+		return page->frame->kva;
+	}
+	lock_release (&frame_lock);
+
+	frame = vm_get_frame ();
+	if (frame == NULL)
+		return NULL;
+
+	lock_acquire (&frame_lock);
+	cache_wait_io (page);
+	if (page->frame != NULL) {
+		/* Read in by someone else in the meantime. */
+		frame_table_remove (frame);
+		palloc_free_page (frame->kva);
+		free (frame);
+		page->frame->pinned = true;
+		page->frame->referenced = true;
+		page->page_cache.pin_cnt++;
+		lock_release (&frame_lock);
+		return page->frame->kva;
+	}
+	frame->page = page;
+	frame->io_pending = true;
+	page->frame = frame;
+	page->page_cache.pin_cnt++;
+	lock_release (&frame_lock);
+
+	if (fill) {
+		thread_current ()->fault_io = true;
+		ok = swap_in (page, frame->kva);
+	} else
+		memset (frame->kva, 0, PGSIZE);
+
+	lock_acquire (&frame_lock);
+	frame->io_pending = false;
+	if (!ok) {
+		page->page_cache.pin_cnt--;
+		page->frame = NULL;
+		frame_table_remove (frame);
+		palloc_free_page (frame->kva);
+		free (frame);
+	}
+	cond_broadcast (&io_done, &frame_lock);
+	lock_release (&frame_lock);
+	return ok ? frame->kva : NULL;
+}
+
+/* Pin the frame of PAGE, a page of the page cache, and return its
+ * kernel virtual address, if it is resident and dirty, clearing its
+ * dirty bits so that it can be written back.  Returns NULL otherwise.
+ * Never waits, so that it may be called with the page cache locked. */
+void *
+vm_cache_pin_dirty (struct page *page) {
+	void *kva = NULL;
+
+	lock_acquire (&frame_lock);
+	if (page->frame != NULL && !page->frame->io_pending
+			&& frame_cache_dirty (page->frame)) {
+		page->page_cache.dirty = false;
+		page->page_cache.pin_cnt++;
+		page->frame->pinned = true;
+		kva = page->frame->kva;
+	}
+	lock_release (&frame_lock);
+	return kva;
+}
+
+/* Undo vm_cache_pin() or vm_cache_pin_dirty() on PAGE.  If DIRTY is
+ * true, the caller changed the frame, or failed to write it back. */
+void
+vm_cache_unpin (struct page *page, bool dirty) {
+	lock_acquire (&frame_lock);
+	cache_unpin (page, dirty);
+	lock_release (&frame_lock);
+}
+
+/* Start reading PAGE, a page of the page cache, into a frame in the
+ * readahead thread, unless it is resident.  Returns false if free
+ * frames are short. */
+bool
+vm_cache_prefetch (struct page *page) {
+	return page->frame != NULL || frame_alloc_ahead (page, true) != NULL;
+}
+
+/* Free the frame of PAGE, a page of the page cache that nothing maps
+ * anymore, once nobody is copying to or from it. */
+void
+vm_cache_release (struct page *page) {
+	struct frame *frame;
+
+	lock_acquire (&frame_lock);
+	while (page->frame != NULL && (page->frame->io_pending
+				|| page->page_cache.pin_cnt > 0))
+		cond_wait (&io_done, &frame_lock);
+	frame = page->frame;
+	if (frame != NULL) {
+		ASSERT (list_empty (&frame->pages));
+		page->frame = NULL;
+		frame_table_remove (frame);
+		palloc_free_page (frame->kva);
+		free (frame);
+	}
+	lock_release (&frame_lock);
+}
+
+/* Detach PAGE from its frame. If no other page uses the frame anymore,
+ * the frame leaves the frame table and is freed, and its kernel virtual
+ * address is returned so the caller can decide what to do with the
+ * memory; otherwise returns NULL. */
+void *
+vm_frame_detach (struct page *page) {
+	struct frame *frame;
+	void *kva = NULL;
+
+	/* Under the lock, PAGE cannot be evicted by another thread. */
+	lock_acquire (&frame_lock);
+	frame = page->frame;
+	if (frame == NULL)
+		goto done;
+	page->frame = NULL;
+	if (frame == &zero_frame)
+		goto done;
+	if (frame_is_cache (frame) && frame->page != page) {
+		/* A mapping of the page cache.  The frame stays in the cache,
+		 * with what the mapping wrote to it. */
+		uint64_t *pml4 = page->owner->pml4;
+
+		list_remove (&page->frame_elem);
+		if (pml4 != NULL && pml4_is_dirty (pml4, page->va))
+			frame->page->page_cache.dirty = true;
+		goto done;
+	}
+	if (frame->huge_refs > 0) {
+		/* Pages of a huge frame only go away together, at exit. Stop the
+		 * clock from looking at the frame, and free it with the last. */
+		if (frame->page != NULL) {
+			list_remove (&frame->page->frame_elem);
+			frame->page = NULL;
+		}
+		if (--frame->huge_refs > 0)
+			goto done;
+	} else {
+		list_remove (&page->frame_elem);
+		if (!list_empty (&frame->pages)) {
+			if (frame->page == page)
+				frame->page = list_entry (list_front (&frame->pages),
+						struct page, frame_elem);
+			goto done;
+		}
+	}
+
+	kva = frame->kva;
+	frame_table_remove (frame);
+	free (frame);
+done:
+	lock_release (&frame_lock);
+	return kva;
 }
 
-/* Get the type of the page. This function is useful if you want to know the
- * type of the page after it will be initialized.
- * This function is fully implemented now. */
-enum vm_type
-page_get_type (struct page *page) {
-	int ty = VM_TYPE (page->operations->type);
-	switch (ty) {
-		case VM_UNINIT:
-			return VM_TYPE (page->uninit.type);
-		default:
-			return ty;
+/* Try to back the whole 2 MiB aligned region around VA with a single
+ * huge frame mapped by one page-directory entry.  This only happens
+ * when the region lies in the zero-filled part of a writable anonymous
+ * area (such as a large BSS), none of its pages was touched yet, and
+ * the user pool still has an aligned run of free frames.  Otherwise the
+ * caller falls back to a 4 kB claim. */
+static bool
+vm_claim_huge_page (void *va) {
+	struct thread *t = thread_current ();
+	uint8_t *base = (uint8_t *) ROUND_DOWN ((uint64_t) va, LARGE_PGSIZE);
+	struct vm_area *area = vm_area_find (&t->spt, va);
+	struct frame *frame;
+	size_t i;
+
+	if (area == NULL || area->type != VM_ANON || !area->writable
+			|| (void *) base < area->start
+			|| area->end < (void *) (base + LARGE_PGSIZE)
+			|| vm_area_page_read_bytes (area, base) != 0)
+		return false;
+
+	for (i = 0; i < HUGE_PAGE_CNT; i++)
+		if (spt_find_page (&t->spt, base + i * PGSIZE) != NULL)
+			return false;
+
+	/* Do not take a whole huge frame out of the reclaim reserve, or
+	 * beyond the hard limit of the memory control group. */
+	if (palloc_free_cnt (PAL_USER) < HUGE_PAGE_CNT + vm_wmark_high
+			|| memcg_at_limit (memcg_of (t), HUGE_PAGE_CNT))
+		return false;
+
+	frame = malloc (sizeof (struct frame));
+	if (frame == NULL)
+		return false;
+
+	frame->kva = palloc_get_multiple_aligned (PAL_USER,
+			HUGE_PAGE_CNT, HUGE_PAGE_CNT);
+	if (frame->kva == NULL)
+		goto free_frame;
+
+	for (i = 0; i < HUGE_PAGE_CNT; i++)
+		if (vm_area_alloc_page (area, base + i * PGSIZE, false) == NULL)
+			goto free_pages;
+
+	if (!pml4_set_large_page (t->pml4, base, frame->kva, true))
+		goto free_pages;
+
+	frame->page = spt_find_page (&t->spt, base);
+	list_init (&frame->pages);
+	list_push_back (&frame->pages, &frame->page->frame_elem);
+	frame->huge_refs = HUGE_PAGE_CNT;
+	frame->pinned = false;
+	frame->io_pending = false;
+	frame->referenced = false;
+	frame->text_cached = false;
+	frame->memcg = memcg_of (t);
+	frame->charged = HUGE_PAGE_CNT;
+	lock_acquire (&frame_lock);
+	memcg_charge (frame->memcg, HUGE_PAGE_CNT);
+	list_push_back (&frame_table, &frame->frt_elem);
+	lock_release (&frame_lock);
+
+	/* Transmute the pages into anon pages; anon_initializer zeroes
+	 * each slice of the frame. */
+	for (i = 0; i < HUGE_PAGE_CNT; i++) {
+		struct page *page = spt_find_page (&t->spt, base + i * PGSIZE);
+
+		page->frame = frame;
+		page->uninit.page_initializer (page, VM_ANON,
+				(uint8_t *) frame->kva + i * PGSIZE);
 	}
-}
 
-/* Helpers */
-static struct frame *vm_get_victim (void);
-static bool vm_do_claim_page (struct page *page);
-static struct frame *vm_evict_frame (void);
+	huge_fault_cnt++;
+	return true;
 
-/* Create the pending page object with initializer. If you want to create a
- * page, do not create it directly and make it through this function or
- * `vm_alloc_page`. */
+free_pages:
+	while (i-- > 0)
+		spt_remove_page (&t->spt, spt_find_page (&t->spt, base + i * PGSIZE));
+	palloc_free_multiple (frame->kva, HUGE_PAGE_CNT);
+free_frame:
+	free (frame);
+	return false;
+}
+
+/* Break the huge frame FRAME into HUGE_PAGE_CNT ordinary frames and map
+ * them with 4 kB entries, so that a single page of the region can be
+ * unmapped, reprotected or evicted.  Returns false on allocation
+ * failure, leaving the huge frame intact. */
 bool
-vm_alloc_page_with_initializer (enum vm_type type, void *upage, bool writable,
-		vm_initializer *init, void *aux) {
+vm_split_huge_frame (struct frame *frame) {
+	struct page *head = frame->page;
+	struct thread *owner = head->owner;
+	bool locked = lock_held_by_current_thread (&frame_lock);
+	struct list frames;
+	size_t i;
 
-	ASSERT (VM_TYPE(type) != VM_UNINIT)
+	ASSERT (frame->huge_refs > 0);
 
-	struct supplemental_page_table *spt = &thread_current ()->spt;
+	list_init (&frames);
+	for (i = 0; i < HUGE_PAGE_CNT; i++) {
+		struct frame *f = malloc (sizeof (struct frame));
 
-	/* Check wheter the upage is already occupied or not. */
-	if (spt_find_page (spt, upage) == NULL) {
-		struct page *spt_page_for_user_process = malloc(sizeof(struct page));
-		
-		switch (VM_TYPE(type)) {
-			case VM_ANON:
-				uninit_new(spt_page_for_user_process, upage, init, type, aux, anon_initializer);
-				break;
-			case VM_FILE:
-				uninit_new(spt_page_for_user_process, upage, init, type, aux, file_backed_initializer);
-				break;
-		}
+		if (f == NULL)
+			goto err;
+		f->kva = (uint8_t *) frame->kva + i * PGSIZE;
+		f->page = NULL;
+		list_init (&f->pages);
+		f->huge_refs = 0;
+		f->pinned = false;
+		f->io_pending = false;
+		f->referenced = false;
+		f->text_cached = false;
+		f->memcg = frame->memcg;
+		f->charged = 1;
+		list_push_back (&frames, &f->frt_elem);
+	}
 
-		spt_page_for_user_process->is_writable = writable;
-		return spt_insert_page(spt, spt_page_for_user_process);
+	if (!pml4_split_large_page (owner->pml4, head->va))
+		goto err;
+
+	if (!locked)
+		lock_acquire (&frame_lock);
+	for (i = 0; i < HUGE_PAGE_CNT; i++) {
+		struct frame *f = list_entry (list_pop_front (&frames),
+				struct frame, frt_elem);
+		struct page *page = spt_find_page (&owner->spt,
+				(uint8_t *) head->va + i * PGSIZE);
+
+		if (page != NULL && page->frame == frame) {
+			f->page = page;
+			page->frame = f;
+			list_push_back (&f->pages, &page->frame_elem);
+		}
+		memcg_charge (f->memcg, 1);
+		list_push_back (&frame_table, &f->frt_elem);
 	}
+
+	/* The group stays charged for the region throughout. */
+	frame_table_remove (frame);
+	if (!locked)
+		lock_release (&frame_lock);
+	free (frame);
+	huge_split_cnt++;
+	return true;
+
 err:
+	while (!list_empty (&frames))
+		free (list_entry (list_pop_front (&frames), struct frame, frt_elem));
 	return false;
 }
 
-/* Find VA from spt and return page. On error, return NULL. */
-struct page *
-spt_find_page (struct supplemental_page_table *spt UNUSED, void *va UNUSED) {
-	if (!list_empty(&spt->sptable_list)) {
-		struct list_elem *e;
-		
-		for (e = list_front(&spt->sptable_list); e != list_end(&spt->sptable_list); e = list_next(e)) {
-			struct page *_page = list_entry(e, struct page, spt_elem);
-			
-			if (_page->va == pg_round_down(va)) {
-				return _page;
-			}
-		}
+/* Returns an upper bound, in TSC cycles, on the latency of PCT percent
+ * of the faults handled so far. */
+static unsigned long long
+fault_latency_percentile (int pct) {
+	size_t total = 0, seen = 0;
+	int b;
+
+	for (b = 0; b < LATENCY_BUCKETS; b++)
+		total += fault_latency[b];
+	if (total == 0)
+		return 0;
+
+	for (b = 0; b < LATENCY_BUCKETS - 1; b++) {
+		seen += fault_latency[b];
+		if (seen * 100 >= total * pct)
+			break;
 	}
+	return 2ULL << b;
+}
 
-	return NULL;
+/* Prints virtual memory statistics. */
+void
+vm_print_stats (void) {
+	printf ("VM: %zu page faults, %zu evictions\n", fault_cnt, evict_cnt);
+	printf ("VM: %zu huge page faults, %zu huge page splits\n",
+			huge_fault_cnt, huge_split_cnt);
+	printf ("VM: watermarks %zu/%zu/%zu pages, kswapd woke %zu times and "
+			"freed %zu frames, %zu direct evictions\n",
+			vm_wmark_min, vm_wmark_low, vm_wmark_high,
+			kswapd_wake_cnt, kswapd_evict_cnt, direct_evict_cnt);
+	printf ("VM: %zu forks, %llu cycles each, %zu frames shared, "
+			"%zu copied and %zu reused on write\n", fork_cnt,
+			fork_cnt > 0 ? (unsigned long long) (fork_cycles / fork_cnt) : 0,
+			cow_share_cnt, cow_copy_cnt, cow_reuse_cnt);
+	printf ("VM: %zu read faults served by the zero page, %zu later written\n",
+			zero_fault_cnt, zero_copy_cnt);
+	printf ("VM: %zu pages read ahead, %zu readahead hits, "
+			"%zu pages mapped around faults\n",
+			ra_page_cnt, ra_hit_cnt, fault_around_cnt);
+	printf ("VM: %zu text pages mapped from the text cache, "
+			"%zu read into it\n", text_hit_cnt, text_fill_cnt);
+	printf ("VM: fault latency p50 %llu, p90 %llu, p99 %llu cycles\n",
+			fault_latency_percentile (50), fault_latency_percentile (90),
+			fault_latency_percentile (99));
+	anon_print_stats ();
+	file_print_stats ();
+	page_cache_print_stats ();
+	memcg_print_stats ();
 }
 
-/* Insert PAGE into spt with validation. */
-bool
-spt_insert_page (struct supplemental_page_table *spt UNUSED,
-		struct page *page UNUSED) {
-	list_push_back(&spt->sptable_list, &page->spt_elem);
+/* Growing the stack.  The stack grows in one step down to the page of
+ * ADDR, and by at least vm_stack_chunk pages, but never below
+ * STACK_LIMIT.  The pages from ADDR up to the old end of the stack lie
+ * inside whatever is being pushed, so they are faulted in right away
+ * instead of one fault each; the pages below ADDR are left for their
+ * first touch.  Returns true if the page of ADDR is resident. */
+static bool
+vm_stack_growth (void *addr UNUSED) {
+	struct thread *t = thread_current();
+	uint8_t *old_end = t->stack_page_end;
+	uint8_t *end = pg_round_down(addr);
+	
+	if (end >= old_end) {
+		return false;
+	}
+	
+	if ((size_t) (old_end - STACK_LIMIT) / PGSIZE <= vm_stack_chunk)
+		end = STACK_LIMIT;
+	else if (old_end - vm_stack_chunk * PGSIZE < end)
+		end = old_end - vm_stack_chunk * PGSIZE;
+	
+	while ((uint8_t *) t->stack_page_end > end) {
+		if (!vm_alloc_page(VM_ANON | VM_MARKER_0, t->stack_page_end - PGSIZE, 1))
+			break;
+		t->stack_page_end -= PGSIZE;
+	}
+	
+	for (uint8_t *va = pg_round_down(addr); va < old_end; va += PGSIZE) {
+		if (va >= (uint8_t *) t->stack_page_end && !vm_claim_page(va))
+			return false;
+	}
+	
+	if ((uint8_t *) pg_round_down(addr) < (uint8_t *) t->stack_page_end) {
+		return false;
+	}
+	
+	t->vmstat.stack_faults++;
 	return true;
 }
 
-void
-spt_remove_page (struct supplemental_page_table *spt, struct page *page) {
-	vm_dealloc_page (page);
+/* Handle the fault on write_protected page.
+ * PAGE shares its frame copy-on-write, or maps the zero frame.  The
+ * last page using a shared frame takes it over; otherwise PAGE gets a
+ * copy of its own. */
+static bool
+vm_handle_wp (struct page *page) {
+	uint64_t *pml4 = thread_current ()->pml4;
+	struct frame *old, *new = NULL;
+
+	thread_current ()->vmstat.cow_faults++;
+	for (;;) {
+		lock_acquire (&frame_lock);
+		old = page->frame;
+
+		/* Evicted in the meantime, or being written out by kswapd: the
+		 * retried access faults it back in. */
+		if (old == NULL || old->io_pending)
+			break;
+
+		/* No longer shared: take the frame over. */
+		if (old != &zero_frame && !frame_cow (old)) {
+			pml4_set_writable (pml4, page->va, true);
+			cow_reuse_cnt++;
+			break;
+		}
+
+		if (new != NULL)
+			goto copy;
+		lock_release (&frame_lock);
+
+		new = vm_get_frame ();
+		if (new == NULL)
+			return false;
+	}
+
+	/* The new frame was not needed after all. */
+	if (new != NULL) {
+		frame_table_remove (new);
+		palloc_free_page (new->kva);
+		free (new);
+	}
+	lock_release (&frame_lock);
+	return true;
+
+copy:
+	if (old == &zero_frame) {
+		memset (new->kva, 0, PGSIZE);
+		zero_copy_cnt++;
+	} else {
+		memcpy (new->kva, old->kva, PGSIZE);
+		list_remove (&page->frame_elem);
+		if (old->page == page)
+			old->page = list_entry (list_front (&old->pages),
+					struct page, frame_elem);
+		cow_copy_cnt++;
+	}
+	new->page = page;
+	page->frame = new;
+	list_push_back (&new->pages, &page->frame_elem);
+
+	pml4_clear_page (pml4, page->va);
+	pml4_set_page (pml4, page->va, new->kva, true);
+	new->pinned = false;
+	lock_release (&frame_lock);
 	return true;
 }
 
-/* Get the struct frame, that will be evicted. */
-static struct frame *
-vm_get_victim (void) {
-	struct frame *victim = NULL;
-	 /* TODO: The policy for eviction is up to you. */
+/* Map the zero frame read-only at VA, for a read fault on a page that
+ * has never been written and would be zero-filled: an untouched page of
+ * the zero-filled part of an anonymous area, or a new stack page.
+ * Returns false if VA holds no such page. */
+static bool
+vm_map_zero_page (void *va) {
+	struct thread *t = thread_current ();
+	struct page *page = spt_find_page (&t->spt, va);
 
-	 // FIXME: get victim, maybe we need frame priority... For now just pop from table
-	struct list_elem *e = list_pop_front(&frame_table);
-	victim = list_entry(e, struct frame, frt_elem);
+	if (page == NULL) {
+		struct vm_area *area = vm_area_find (&t->spt, va);
 
-	return victim;
-}
+		if (area == NULL || area->type != VM_ANON
+				|| vm_area_page_read_bytes (area, pg_round_down (va)) != 0)
+			return false;
+		page = vm_area_alloc_page (area, va, false);
+		if (page == NULL)
+			return false;
+	} else if (page->operations->type != VM_UNINIT
+			|| VM_TYPE (page->uninit.type) != VM_ANON
+			|| page->uninit.init != NULL)
+		return false;
 
-/* Evict one page and return the corresponding frame.
- * Return NULL on error.*/
-static struct frame *
-vm_evict_frame (void) {
-	struct frame *victim UNUSED = vm_get_victim ();
-	/* TODO: swap out the victim and return the evicted frame. */
-	swap_out(victim->page);
-	return NULL;
+	/* If this fails, the page stays uninit and is claimed as usual. */
+	if (!pml4_set_page (t->pml4, page->va, zero_frame.kva, false))
+		return false;
+	anon_init_zero (page);
+	page->frame = &zero_frame;
+	zero_fault_cnt++;
+	return true;
 }
 
-/* palloc() and get frame. If there is no available page, evict the page
- * and return it. This always return valid address. That is, if the user pool
- * memory is full, this function evicts the frame to get the available memory
- * space.*/
-static struct frame *
-vm_get_frame (void) {
-	struct frame *frame = malloc(sizeof(struct frame));
-	/* TODO: Fill this function. */
-	
-	void* candidate_virtual_address = palloc_get_page(PAL_USER);
-	
-	if (candidate_virtual_address == NULL) {
-		// USER POOL IS FULL
-		frame = vm_evict_frame(); // evict always success
-	} else {
-		frame->kva = candidate_virtual_address;
+/* Return true on success.
+ * Records how long the fault took in the latency histogram, and counts
+ * it as a major fault of the process if it had to wait for the disk or
+ * as a minor one otherwise. */
+bool
+vm_try_handle_fault (struct intr_frame *f, void *addr, bool user,
+		bool write, bool not_present) {
+	struct thread *t = thread_current ();
+	uint64_t start = rdtsc ();
+	bool success;
+	uint64_t cycles;
+	int b = 0;
+
+	t->fault_io = false;
+	success = vm_handle_fault (f, addr, user, write, not_present);
+	cycles = rdtsc () - start;
+	while (cycles >>= 1)
+		b++;
+	fault_latency[b]++;
+
+	if (success) {
+		if (t->fault_io)
+			t->vmstat.major_faults++;
+		else
+			t->vmstat.minor_faults++;
+		vm_ws_sample ();
 	}
-	
-	// FIXME: is it correct to doing like this?
-	list_push_back(&frame_table, &frame->frt_elem);
-	frame->page = NULL;
+	return success;
+}
 
-	ASSERT (frame != NULL);
-	ASSERT (frame->page == NULL);
-	return frame;
+/* Take a working set sample of the current process if the last one is
+ * WS_SAMPLE_TICKS old.  Only the owner may walk its page table, so the
+ * sample is taken when the process faults or enters the kernel rather
+ * than from the timer interrupt.  The accessed bits are handed on to
+ * the frames, so that clearing them does not make the clock think the
+ * pages are idle. */
+void
+vm_ws_sample (void) {
+	struct thread *t = thread_current ();
+	int64_t now = timer_ticks ();
+	struct hash_iterator i;
+
+	if (t->pml4 == NULL || now - t->ws_sampled < WS_SAMPLE_TICKS)
+		return;
+	t->ws_sampled = now;
+
+	lock_acquire (&frame_lock);
+	hash_first (&i, &t->spt.sptable_hash);
+	while (hash_next (&i)) {
+		struct page *page = hash_entry (hash_cur (&i), struct page, spt_elem);
+
+		page->ws_hist <<= 1;
+		if (page->frame != NULL && pml4_is_accessed (t->pml4, page->va)) {
+			pml4_set_accessed (t->pml4, page->va, false);
+			page->frame->referenced = true;
+			page->ws_hist |= 1;
+		}
+	}
+	lock_release (&frame_lock);
 }
 
-/* Growing the stack. */
-static void
-vm_stack_growth (void *addr UNUSED) {
-	struct thread *t = thread_current();
-	bool alloc_result = vm_alloc_page(VM_ANON | VM_MARKER_0, t->stack_page_end - PGSIZE, 1);
-	
-	if (alloc_result) {
-		t->stack_page_end -= PGSIZE;
+/* Fill STAT with the memory use of the current process.  The accessed
+ * bits are only read, so asking does not disturb the sampling. */
+void
+vm_stat (struct vmstat *stat) {
+	struct thread *t = thread_current ();
+	struct hash_iterator i;
+	int w;
+
+	*stat = t->vmstat;
+	stat->resident = 0;
+	for (w = 0; w < 3; w++)
+		stat->wss[w] = 0;
+
+	lock_acquire (&frame_lock);
+	hash_first (&i, &t->spt.sptable_hash);
+	while (hash_next (&i)) {
+		struct page *page = hash_entry (hash_cur (&i), struct page, spt_elem);
+		bool accessed = page->frame != NULL
+			&& pml4_is_accessed (t->pml4, page->va);
+
+		if (page->frame != NULL && page->frame != &zero_frame)
+			stat->resident++;
+		for (w = 0; w < 3; w++)
+			if (accessed || (page->ws_hist & ws_masks[w]) != 0)
+				stat->wss[w]++;
 	}
+	lock_release (&frame_lock);
 }
 
-/* Handle the fault on write_protected page */
-static bool
-vm_handle_wp (struct page *page UNUSED) {
+/* Print the memory use of the current process on one line of KEY=VALUE
+ * pairs, after its exit status. */
+void
+vm_print_exit_stats (void) {
+	struct vmstat stat;
+
+	vm_stat (&stat);
+	printf ("%s: vmstat majflt=%lu minflt=%lu stkflt=%lu cowflt=%lu "
+			"swapin=%lu rss=%lu wss1=%lu wss4=%lu wss8=%lu\n",
+			thread_name (), stat.major_faults, stat.minor_faults,
+			stat.stack_faults, stat.cow_faults, stat.swap_ins, stat.resident,
+			stat.wss[0], stat.wss[1], stat.wss[2]);
 }
 
-/* Return true on success */
-bool
-vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
+/* Handle a page fault at ADDR. Return true on success */
+static bool
+vm_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
 		bool user UNUSED, bool write UNUSED, bool not_present UNUSED) {
 	struct supplemental_page_table *spt UNUSED = &thread_current ()->spt;
 	/* TODO: Validate the fault */
@@ -181,20 +1811,30 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
 	if (is_kernel_vaddr(addr)) {
 		return false;
 	}
+	
+	fault_cnt++;
 
 	if (not_present) {
 		struct thread *t = thread_current();
 		void* current_rsp = user ? f->rsp : t->current_rsp;
 		
+		// Reads of untouched zero-filled memory cost no frame.
+		if (!write && vm_map_zero_page(addr)) {
+			return true;
+		}
+		
+		if (vm_claim_huge_page(addr)) {
+			return true;
+		}
+		
 		if (!vm_claim_page(addr)) {
 			// x86 Push occurs fault 8 bytes below the rsp, so check the addr is 8bytes under.
 			bool is_out_of_stack = current_rsp - 8 <= addr;
-			bool is_over_1MB_stack = USER_STACK - 1000000 > addr;
+			bool is_over_1MB_stack = STACK_LIMIT > (uint8_t *) addr;
 			bool is_in_stack = USER_STACK >= addr;
 
 			if (is_out_of_stack && !is_over_1MB_stack && is_in_stack) {
-				vm_stack_growth(addr);
-				return true;
+				return vm_stack_growth(addr);
 			}
 			
 			return false;
@@ -203,6 +1843,14 @@ vm_try_handle_fault (struct intr_frame *f UNUSED, void *addr UNUSED,
 		return true;
 	}
 	
+	/* A write to a present page that is writable shares its frame. */
+	if (write) {
+		struct page *page = spt_find_page(spt, addr);
+		
+		if (page != NULL && page->is_writable)
+			return vm_handle_wp(page);
+	}
+	
 	return false;
 }
 
@@ -222,20 +1870,89 @@ vm_claim_page (void *va UNUSED) {
 	struct page *page = spt_find_page(&t->spt, va);
 	
 	if (page == NULL) {
+		/* Pages of an area are created on their first fault. */
+		struct vm_area *area = vm_area_find(&t->spt, va);
+		
+		if (area == NULL) {
+			return 0;
+		}
+		
+		page = vm_area_alloc_page(area, va, true);
+		
+		if (page == NULL) {
+			return 0;
+		}
+	} else {
+		/* Read ahead already: only the mapping is missing. */
+		bool mapped = false;
+		
+		if (vm_map_resident(page, &mapped)) {
+			if (mapped && page->area != NULL) {
+				ra_hit_cnt++;
+				readahead(page->area, page->va, true);
+				fault_around(page);
+			}
+			return mapped;
+		}
+	}
+	
+	bool hit = false;
+	
+	if (page_maps_cache(page)) {
+		// File data is mapped straight from the page cache.
+		if (!vm_map_cache(page, &hit)) {
+			return 0;
+		}
+		if (hit) {
+			ra_hit_cnt++;
+		}
+	} else if (!vm_map_text(page) && !vm_do_claim_page (page)) {
+		// Text another process has read already costs no disk read.
 		return 0;
 	}
 	
-	return vm_do_claim_page (page);
+	if (page->area != NULL) {
+		readahead(page->area, page->va, hit);
+		fault_around(page);
+	}
+	
+	return 1;
 }
 
 /* Claim the PAGE and set up the mmu. */
 static bool
 vm_do_claim_page (struct page *page) {
+	struct frame *frame = vm_claim_frame (page);
+	
+	if (frame == NULL) {
+		return 0;
+	}
+	
+	/* Filled, the clock may pick the frame from now on. */
+	if (page->area != NULL) {
+		lock_acquire(&frame_lock);
+		text_cache_add(frame, page);
+		lock_release(&frame_lock);
+	}
+	frame->pinned = false;
+	
+	return 1;
+}
+
+/* Claim PAGE like vm_do_claim_page, but return its frame still pinned,
+ * so that the caller can finish filling it. Returns NULL on failure. */
+static struct frame *
+vm_claim_frame (struct page *page) {
 	struct frame *frame = vm_get_frame ();
+	
+	if (frame == NULL) {
+		return NULL;
+	}
 
 	/* Set links */
 	frame->page = page;
 	page->frame = frame;
+	list_push_back (&frame->pages, &page->frame_elem);
 
 	/* TODO: Insert page table entry to map page's VA to frame's PA. */
 	struct thread *t = thread_current ();
@@ -244,88 +1961,211 @@ vm_do_claim_page (struct page *page) {
 	 * address, then map our page there. */
 	bool result = ((pml4_get_page (t->pml4, page->va) == NULL) && pml4_set_page (t->pml4, page->va, frame->kva, page->is_writable));
 
-	if (!result) {
+	if (!result || !swap_in (page, frame->kva)) {
+		frame->pinned = false;
+		return NULL;
+	}
+	
+	return frame;
+}
+
+/* Fill DST, a new page of the current process, with a copy of SRC, a
+ * file-backed page of its parent. */
+static bool
+page_copy (struct page *dst, struct page *src) {
+	struct frame *frame = vm_claim_frame (dst);
+	
+	if (frame == NULL) {
 		return 0;
 	}
+	
+	/* The lock keeps SRC from being evicted while it is copied. */
+	lock_acquire(&frame_lock);
+	if (src->frame != NULL) {
+		uint8_t *src_kva = src->frame->kva;
+		
+		// Part of a huge frame: find this page's slice of it.
+		if (src->frame->huge_refs > 0)
+			src_kva += (uint8_t *) src->va - (uint8_t *) src->frame->page->va;
+		
+		memcpy(frame->kva, src_kva, PGSIZE);
+		lock_release(&frame_lock);
+	} else {
+		lock_release(&frame_lock);
+		
+		// Evicted meanwhile, so the file is up to date.
+		if (!lazy_load_segment(dst, NULL)) {
+			frame->pinned = false;
+			return 0;
+		}
+	}
+	
+	frame->pinned = false;
+	return 1;
+}
 
-	bool result2 = swap_in (page, frame->kva);
+/* Let DST, a new page of the current process, share the contents of
+ * SRC, an anonymous page of its parent, copy-on-write.  A resident SRC
+ * gives DST its frame, mapped read-only in both processes until one of
+ * them writes; a swapped-out SRC gives DST its swap slot. */
+static bool
+page_share (struct page *dst, struct page *src) {
+	struct thread *t = thread_current ();
+	struct frame *frame;
+	
+	lock_acquire(&frame_lock);
+	// kswapd may be writing the frame out.
+	while (src->frame != NULL && src->frame->io_pending)
+		cond_wait(&io_done, &frame_lock);
+	frame = src->frame;
 	
-	return result2;
+	// Frames are shared 4 kB at a time.
+	if (frame != NULL && frame->huge_refs > 0) {
+		if (!vm_split_huge_frame(frame))
+			goto err;
+		frame = src->frame;
+	}
+	
+	if (frame == &zero_frame) {
+		// Nothing to share but the zero frame itself.
+		if (!pml4_set_page(t->pml4, dst->va, frame->kva, false))
+			goto err;
+		dst->frame = frame;
+	} else if (frame != NULL) {
+		if (!pml4_set_page(t->pml4, dst->va, frame->kva, false))
+			goto err;
+		pml4_set_writable(src->owner->pml4, src->va, false);
+		dst->frame = frame;
+		list_push_back(&frame->pages, &dst->frame_elem);
+		cow_share_cnt++;
+	}
+	anon_share(dst, src);
+	lock_release(&frame_lock);
+	return true;
+	
+err:
+	lock_release(&frame_lock);
+	return false;
+}
+
+/* Returns a hash value for page P, from its virtual page number. */
+static uint64_t
+page_hash (const struct hash_elem *p_, void *aux UNUSED) {
+	const struct page *p = hash_entry(p_, struct page, spt_elem);
+	return hash_int(pg_no(p->va));
+}
+
+/* Returns true if page A precedes page B. */
+static bool
+page_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED) {
+	const struct page *a = hash_entry(a_, struct page, spt_elem);
+	const struct page *b = hash_entry(b_, struct page, spt_elem);
+	return a->va < b->va;
 }
 
 /* Initialize new supplemental page table */
 void
 supplemental_page_table_init (struct supplemental_page_table *spt UNUSED) {
-	list_init(&spt->sptable_list);
+	hash_init(&spt->sptable_hash, page_hash, page_less, NULL);
+	list_init(&spt->areas);
+	spt->area_cache = NULL;
 }
 
 /* Copy supplemental page table from src to dst */
 bool
 supplemental_page_table_copy (struct supplemental_page_table *dst UNUSED, struct supplemental_page_table *src UNUSED) {
 	// NOTE: current thread is child, containing dst table. src is from parent interrupt frame.
+	struct hash_iterator i;
+	uint64_t start = rdtsc();
 	
-	if (!list_empty(&src->sptable_list)) {
-		struct list_elem *e;
+	// Areas first: their untouched pages are faulted in by the child itself.
+	if (!vm_area_copy(dst, src))
+		goto err;
+	
+	hash_first(&i, &src->sptable_hash);
+	while (hash_next(&i)) {
+		struct page *src_p = hash_entry(hash_cur(&i), struct page, spt_elem);
+		
+		// A page still being read ahead is copied once it is filled.
+		frame_wait_io(src_p);
+		
+		// Copy
+		void* src_upage = src_p->va;
+		bool writable = src_p->is_writable;
+		
+		// Candidate type, also if uninit (anon, file_backed...)
+		enum vm_type src_p_type = page_get_type(src_p);
 		
-		for (e = list_front(&src->sptable_list); e != list_end(&src->sptable_list); e = list_next(e))  {
-			struct page *src_p = list_entry(e, struct page, spt_elem);
+		// if page is uninit
+		vm_initializer *init = src_p->uninit.init;
+		void *aux = src_p->uninit.aux;
+
+		if (src_p->area != NULL) {
+			// Untouched pages and evicted file pages are read again by the child.
+			// Mappings of the page cache map it again in the child.
+			if (src_p->operations->type == VM_UNINIT
+					|| (src_p->operations->type == VM_FILE && src_p->frame == NULL)
+					|| page_maps_cache(src_p))
+				continue;
 			
-			// Copy
-			void* src_upage = src_p->va;
-			bool writable = src_p->is_writable;
+			// Anonymous pages are shared, file pages are copied.
+			struct vm_area *dst_area = vm_area_find(dst, src_upage);
+			struct page *dst_p = vm_area_alloc_page(dst_area, src_upage, false);
 			
-			// Candidate type, also if uninit (anon, file_backed...)
-			enum vm_type src_p_type = page_get_type(src_p);
+			if (dst_p == NULL)
+				goto err;
+			if (!(src_p_type == VM_ANON ? page_share(dst_p, src_p) : page_copy(dst_p, src_p)))
+				goto err;
+		} else if (src_p->operations->type == VM_UNINIT) {
+			// Uninitialized pages
+			bool alloc_with_init_result = vm_alloc_page_with_initializer(src_p_type, src_upage, writable, init, aux);
 			
-			// if page is uninit
-			vm_initializer *init = src_p->uninit.init;
-			void *aux = src_p->uninit.aux;
-
-			if (src_p->operations->type == VM_UNINIT) {
-				// Uninitialized pages
-				bool alloc_with_init_result = vm_alloc_page_with_initializer(src_p_type, src_upage, writable, init, aux);
-				
-				if (!alloc_with_init_result)
-					goto err;
-			} else {
-				// Already initialized pages, no need to use init
-				bool alloc_result = vm_alloc_page(src_p_type, src_upage, writable);
-
-				if (!alloc_result)
-					goto err;
-
-				// Claim the page, cause they're already claimed. (Not uninit)
-				bool claim_result = vm_claim_page(src_upage);
-
-				if (!claim_result)
-					goto err;
-
-				// Cause we already allocated the page, src_upage must be in dst.
-				struct page *dst_p = spt_find_page(dst, src_upage);
-				memcpy(dst_p->frame->kva, src_p->frame->kva, PGSIZE);
-			}
+			if (!alloc_with_init_result)
+				goto err;
+		} else {
+			// Already initialized pages, no need to use init
+			bool alloc_result = vm_alloc_page(src_p_type, src_upage, writable);
+
+			if (!alloc_result)
+				goto err;
+
+			// Cause we already allocated the page, src_upage must be in dst.
+			struct page *dst_p = spt_find_page(dst, src_upage);
+
+			// Share it, cause they're already claimed. (Not uninit)
+			if (!page_share(dst_p, src_p))
+				goto err;
 		}
 	}
 
+	fork_cnt++;
+	fork_cycles += rdtsc() - start;
 	return true;
 	
 err:
 	return false;
 }
 
+/* Frees the page that hash element E is embedded in. */
+static void
+spt_destroy_page (struct hash_elem *e, void *aux UNUSED) {
+	struct page *_page = hash_entry(e, struct page, spt_elem);
+	
+	ASSERT(_page != NULL);
+	
+	frame_wait_io(_page);
+	vm_dealloc_page(_page);
+}
+
 /* Free the resource hold by the supplemental page table */
 void
 supplemental_page_table_kill (struct supplemental_page_table *spt UNUSED) {
-	if (!list_empty(&spt->sptable_list)) {
-		struct list_elem *e = list_front(&spt->sptable_list);
-
-		while (e != list_end(&spt->sptable_list)) {
-			struct page *_page = list_entry(e, struct page, spt_elem);
-			
-			ASSERT(_page != NULL);
-
-			e = list_remove(&_page->spt_elem);
-			vm_dealloc_page(_page);
-		}
-	}
+	struct tlb_batch batch;
+	
+	// Areas first, so their pages leave the area lists before being freed.
+	tlb_batch_begin(&batch);
+	vm_area_kill(spt);
+	hash_destroy(&spt->sptable_hash, spt_destroy_page);
+	tlb_batch_end(&batch);
 }
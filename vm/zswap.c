@@ -0,0 +1,412 @@
+/* zswap.c: Compressed cache in front of the swap disk.
+ *
+ * A page that is swapped out keeps its swap slot, but its contents go
+ * to a pool in kernel memory, compressed with a small LZ77 codec,
+ * rather than to the disk.  The compressed pages live in malloc()
+ * blocks, and the pool is charged the whole power-of-two block of each.
+ * Only pages whose block fits the largest size class that malloc()
+ * carves out of an arena are taken: anything bigger would get a page of
+ * its own, and save nothing.  kswapd writes the pages stored longest
+ * ago out to their slots on the disk to keep room in the pool; a page
+ * that finds the pool full goes to the disk directly.  A page read
+ * back from the pool, or freed while in it, never costs any disk
+ * I/O. */
+
+#include "vm/zswap.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+#include "vm/vm.h"
+
+/* A page in the pool. */
+struct zswap_entry {
+	size_t slot;                /* Swap slot of the page. */
+	size_t len;                 /* Bytes of compressed data. */
+	bool writeback;             /* Being written to the disk. */
+	struct hash_elem elem;      /* In zswap_map. */
+	struct list_elem lru_elem;  /* In zswap_lru. */
+	uint8_t data[];             /* Compressed contents. */
+};
+
+/* Largest block taken for a page, the largest size class of malloc(),
+ * and the compressed size that fits. */
+#define ZSWAP_MAX_BLOCK (PGSIZE / 4)
+#define ZSWAP_MAX_LEN (ZSWAP_MAX_BLOCK - sizeof (struct zswap_entry))
+
+static struct hash zswap_map;    /* Entries by slot. */
+static struct list zswap_lru;    /* Entries, most recently used first. */
+static size_t pool_bytes;        /* Bytes of the blocks in the pool. */
+static size_t pool_max_bytes;    /* Size of the pool, 0 if disabled. */
+static uint8_t *zswap_buf;       /* Scratch page for the codec. */
+static uint8_t *writeback_buf;   /* Page being written back. */
+static struct lock zswap_lock;   /* Protects everything in this file. */
+static struct condition writeback_done;  /* An entry left the pool. */
+
+/* Statistics. */
+static size_t store_cnt;         /* Pages taken into the pool. */
+static size_t reject_cnt;        /* Pages that did not compress enough. */
+static size_t full_cnt;          /* Pages that found the pool full. */
+static size_t load_cnt;          /* Pages read back from the pool. */
+static size_t writeback_cnt;     /* Pages written from the pool to disk. */
+static uint64_t stored_bytes;    /* Block bytes of the pages taken. */
+
+/* The codec is a byte-oriented LZ77 in the style of LZ4.  Compressed
+ * data is a series of sequences, each a token byte, literal bytes and
+ * a back-reference: the high nibble of the token is the number of
+ * literals and the low nibble the match length minus LZ_MIN_MATCH,
+ * either followed by 255-valued bytes and a final byte that add to it
+ * when the nibble is 15.  The literals come next, then the two-byte
+ * offset of the match, then the extra match length bytes.  The last
+ * sequence has literals only. */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 11
+
+static uint16_t lz_table[1 << LZ_HASH_BITS];  /* Offsets by hashed bytes. */
+
+static uint32_t
+lz_load32 (const uint8_t *p) {
+	uint32_t v;
+
+	memcpy (&v, p, sizeof v);
+	return v;
+}
+
+/* Appends LEN, less the 15 already in a token nibble, to OP as 255-valued
+ * bytes and a final byte.  Returns the new end of the output. */
+static uint8_t *
+lz_put_len (uint8_t *op, size_t len) {
+	for (len -= 15; len >= 255; len -= 255)
+		*op++ = 255;
+	*op++ = len;
+	return op;
+}
+
+/* Appends the sequence of the LIT_LEN literals at LIT and a match of
+ * MATCH_LEN bytes OFFSET bytes back (none if MATCH_LEN is 0) to OP,
+ * which has room up to OP_END.  Returns the new end of the output, or
+ * NULL if it does not fit. */
+static uint8_t *
+lz_put_seq (uint8_t *op, uint8_t *op_end, const uint8_t *lit,
+		size_t lit_len, size_t offset, size_t match_len) {
+	size_t m = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+
+	if ((size_t) (op_end - op) < lit_len + lit_len / 255 + m / 255 + 5)
+		return NULL;
+
+	*op++ = (lit_len < 15 ? lit_len : 15) << 4 | (m < 15 ? m : 15);
+	if (lit_len >= 15)
+		op = lz_put_len (op, lit_len);
+	memcpy (op, lit, lit_len);
+	op += lit_len;
+	if (match_len > 0) {
+		*op++ = offset & 0xff;
+		*op++ = offset >> 8;
+		if (m >= 15)
+			op = lz_put_len (op, m);
+	}
+	return op;
+}
+
+/* Compresses the N bytes at SRC, at most 64 kB, into DST, which has
+ * room for CAP bytes.  Returns the compressed size, or 0 if it would
+ * exceed CAP. */
+static size_t
+lz_compress (const uint8_t *src, size_t n, uint8_t *dst, size_t cap) {
+	const uint8_t *ip = src, *anchor = src, *end = src + n;
+	uint8_t *op = dst, *op_end = dst + cap;
+
+	memset (lz_table, 0, sizeof lz_table);
+	while (n >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH) {
+		uint32_t seq = lz_load32 (ip);
+		size_t h = (seq * 2654435761u) >> (32 - LZ_HASH_BITS);
+		const uint8_t *match = src + lz_table[h];
+		size_t len = LZ_MIN_MATCH;
+
+		lz_table[h] = ip - src;
+		if (match >= ip || lz_load32 (match) != seq) {
+			ip++;
+			continue;
+		}
+
+		while (ip + len < end && match[len] == ip[len])
+			len++;
+		op = lz_put_seq (op, op_end, anchor, ip - anchor, ip - match, len);
+		if (op == NULL)
+			return 0;
+		ip += len;
+		anchor = ip;
+	}
+
+	op = lz_put_seq (op, op_end, anchor, end - anchor, 0, 0);
+	return op != NULL ? (size_t) (op - dst) : 0;
+}
+
+/* Reads a length continued past a token nibble of 15 from *IP, which
+ * ends at END, and adds it to *LEN.  Returns false on bad input. */
+static bool
+lz_get_len (const uint8_t **ip, const uint8_t *end, size_t *len) {
+	uint8_t b;
+
+	do {
+		if (*ip >= end)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+	} while (b == 255);
+	return true;
+}
+
+/* Decompresses the N bytes at SRC into exactly DST_LEN bytes at DST.
+ * Returns false if SRC is not valid compressed data of that size. */
+static bool
+lz_decompress (const uint8_t *src, size_t n, uint8_t *dst, size_t dst_len) {
+	const uint8_t *ip = src, *end = src + n;
+	uint8_t *op = dst, *op_end = dst + dst_len;
+
+	while (ip < end) {
+		uint8_t token = *ip++;
+		size_t lit_len = token >> 4, match_len = token & 15, offset;
+
+		if ((lit_len == 15 && !lz_get_len (&ip, end, &lit_len))
+				|| lit_len > (size_t) (end - ip)
+				|| lit_len > (size_t) (op_end - op))
+			return false;
+		memcpy (op, ip, lit_len);
+		op += lit_len;
+		ip += lit_len;
+		if (ip == end)
+			break;
+
+		if (end - ip < 2)
+			return false;
+		offset = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (match_len == 15 && !lz_get_len (&ip, end, &match_len))
+			return false;
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (op - dst)
+				|| match_len > (size_t) (op_end - op))
+			return false;
+
+		/* The match may overlap the bytes it produces. */
+		for (; match_len > 0; match_len--, op++)
+			*op = *(op - offset);
+	}
+	return op == op_end;
+}
+
+/* Returns a hash value for entry E, from its slot. */
+static uint64_t
+entry_hash (const struct hash_elem *e, void *aux UNUSED) {
+	return hash_int (hash_entry (e, struct zswap_entry, elem)->slot);
+}
+
+/* Returns true if entry A has a lower slot than entry B. */
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+		void *aux UNUSED) {
+	return hash_entry (a, struct zswap_entry, elem)->slot
+		< hash_entry (b, struct zswap_entry, elem)->slot;
+}
+
+/* Returns the entry for SLOT, or NULL. */
+static struct zswap_entry *
+entry_find (size_t slot) {
+	struct zswap_entry key;
+	struct hash_elem *e;
+
+	key.slot = slot;
+	e = hash_find (&zswap_map, &key.elem);
+	return e != NULL ? hash_entry (e, struct zswap_entry, elem) : NULL;
+}
+
+/* Returns the size of the malloc() block that holds N bytes. */
+static size_t
+block_size (size_t n) {
+	size_t size = 16;
+
+	while (size < n)
+		size *= 2;
+	return size;
+}
+
+/* Removes entry E from the pool and frees it. */
+static void
+entry_free (struct zswap_entry *e) {
+	hash_delete (&zswap_map, &e->elem);
+	if (!e->writeback)
+		list_remove (&e->lru_elem);
+	pool_bytes -= block_size (sizeof *e + e->len);
+	free (e);
+}
+
+/* Sets up a pool of at most MAX_BYTES bytes.  With 0, or if memory is
+ * short, every page goes straight to the disk. */
+void
+zswap_init (size_t max_bytes) {
+	hash_init (&zswap_map, entry_hash, entry_less, NULL);
+	list_init (&zswap_lru);
+	lock_init (&zswap_lock);
+	cond_init (&writeback_done);
+	zswap_buf = palloc_get_page (0);
+	writeback_buf = palloc_get_page (0);
+	pool_max_bytes = zswap_buf != NULL && writeback_buf != NULL
+		? max_bytes : 0;
+}
+
+/* Compresses the page at KVA into the pool, on behalf of swap slot
+ * SLOT, which must not be in the pool.  Never writes to the disk: that
+ * is left to zswap_shrink().  Returns false if the page does not
+ * compress well enough, the pool is full or memory is short; the
+ * caller must then write it to its slot itself. */
+bool
+zswap_store (size_t slot, const void *kva) {
+	struct zswap_entry *e = NULL;
+	size_t len, size;
+
+	if (pool_max_bytes == 0)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	ASSERT (entry_find (slot) == NULL);
+	len = lz_compress (kva, PGSIZE, zswap_buf, ZSWAP_MAX_LEN);
+	if (len == 0) {
+		reject_cnt++;
+		lock_release (&zswap_lock);
+		return false;
+	}
+	size = block_size (sizeof *e + len);
+	if (pool_bytes + size > pool_max_bytes
+			|| (e = malloc (sizeof *e + len)) == NULL) {
+		full_cnt++;
+		lock_release (&zswap_lock);
+		return false;
+	}
+	e->slot = slot;
+	e->len = len;
+	e->writeback = false;
+	memcpy (e->data, zswap_buf, len);
+
+	hash_insert (&zswap_map, &e->elem);
+	list_push_front (&zswap_lru, &e->lru_elem);
+	pool_bytes += size;
+	store_cnt++;
+	stored_bytes += size;
+	lock_release (&zswap_lock);
+	return true;
+}
+
+/* Writes the pages stored longest ago to their slots on the disk until
+ * the pool has room for a page of any size again.  Called by kswapd
+ * without frame_lock, so that zswap_store() rarely finds the pool
+ * full.  zswap_lock is dropped during each write: the entry stays in
+ * the pool until its page is on the disk, so that it is still read
+ * from there, and a slot being freed waits for its write to end. */
+void
+zswap_shrink (void) {
+	if (pool_max_bytes == 0)
+		return;
+
+	lock_acquire (&zswap_lock);
+	while (pool_bytes + ZSWAP_MAX_BLOCK > pool_max_bytes
+			&& !list_empty (&zswap_lru)) {
+		struct zswap_entry *e = list_entry (list_pop_back (&zswap_lru),
+				struct zswap_entry, lru_elem);
+
+		if (!lz_decompress (e->data, e->len, writeback_buf, PGSIZE))
+			PANIC ("zswap: corrupt page for swap slot %zu", e->slot);
+		e->writeback = true;
+		lock_release (&zswap_lock);
+
+		anon_swap_write_slot (e->slot, writeback_buf);
+
+		lock_acquire (&zswap_lock);
+		entry_free (e);
+		cond_broadcast (&writeback_done, &zswap_lock);
+		writeback_cnt++;
+	}
+	lock_release (&zswap_lock);
+}
+
+/* Decompresses the page of swap slot SLOT into KVA, if the pool holds
+ * it.  The page stays in the pool until its slot is freed.  Returns
+ * false if the page is on the disk. */
+bool
+zswap_load (size_t slot, void *kva) {
+	struct zswap_entry *e;
+
+	lock_acquire (&zswap_lock);
+	e = entry_find (slot);
+	if (e != NULL) {
+		if (!lz_decompress (e->data, e->len, kva, PGSIZE))
+			PANIC ("zswap: corrupt page for swap slot %zu", slot);
+		if (!e->writeback) {
+			list_remove (&e->lru_elem);
+			list_push_front (&zswap_lru, &e->lru_elem);
+		}
+		load_cnt++;
+	}
+	lock_release (&zswap_lock);
+	return e != NULL;
+}
+
+/* Returns true if the pool holds the page of swap slot SLOT, which
+ * then must not be read from the disk. */
+bool
+zswap_contains (size_t slot) {
+	bool found;
+
+	if (pool_max_bytes == 0)
+		return false;
+
+	lock_acquire (&zswap_lock);
+	found = entry_find (slot) != NULL;
+	lock_release (&zswap_lock);
+	return found;
+}
+
+/* Drops the page of swap slot SLOT, which is being freed, from the
+ * pool if it is there.  If zswap_shrink() is writing it to the disk,
+ * waits for the write to end, so that it cannot overwrite the next
+ * page given the slot. */
+void
+zswap_invalidate (size_t slot) {
+	struct zswap_entry *e;
+
+	if (pool_max_bytes == 0)
+		return;
+
+	lock_acquire (&zswap_lock);
+	while ((e = entry_find (slot)) != NULL && e->writeback)
+		cond_wait (&writeback_done, &zswap_lock);
+	if (e != NULL)
+		entry_free (e);
+	lock_release (&zswap_lock);
+}
+
+/* Prints pool statistics: how well pages compressed, and how much disk
+ * I/O the pool saved, a write for each page that was never written
+ * back and a read for each page read back from the pool. */
+void
+zswap_print_stats (void) {
+	size_t ratio = stored_bytes > 0
+		? (size_t) ((uint64_t) store_cnt * PGSIZE * 100 / stored_bytes) : 0;
+
+	if (pool_max_bytes == 0)
+		return;
+
+	printf ("Zswap: %zu pages stored, compressed %zu.%02zu:1, "
+			"%zu rejected, %zu refused when full, "
+			"%zu of %zu bytes in use\n", store_cnt, ratio / 100, ratio % 100,
+			reject_cnt, full_cnt, pool_bytes, pool_max_bytes);
+	printf ("Zswap: %zu pages loaded from the pool, %zu written back, "
+			"%zu disk I/Os saved\n", load_cnt, writeback_cnt,
+			store_cnt - writeback_cnt + load_cnt);
+}